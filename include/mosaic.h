@@ -29,10 +29,17 @@
 extern "C" {
 #endif
 
+# include "mosaic/alloc.h"
 # include "mosaic/attr.h"
+# include "mosaic/binary.h"
+# include "mosaic/diff.h"
+# include "mosaic/dirty.h"
 # include "mosaic/error.h"
+# include "mosaic/hash.h"
 # include "mosaic/image.h"
 # include "mosaic/io.h"
+# include "mosaic/render.h"
+# include "mosaic/tile.h"
 
 #ifdef __cplusplus
 }
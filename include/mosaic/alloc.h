@@ -0,0 +1,92 @@
+/*
+ * Copyright 2017 Gil Barbosa Reis <gilzoide@gmail.com>
+ * This file is part of libmosaic.
+ * 
+ * Libmosaic is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Libmosaic is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libmosaic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Any bugs should be reported to <gilzoide@gmail.com>
+ */
+
+/** @file alloc.h
+ * Memory allocation: global allocator hooks and arenas.
+ *
+ * Every allocation libmosaic does goes through the global allocator, which
+ * defaults to the standard `malloc`/`realloc`/`free`. MOSAICs may instead
+ * be drawn from a @ref mos_arena, so that they're all released at once.
+ */
+
+#ifndef __MOSAIC_ALLOC_H__
+#define __MOSAIC_ALLOC_H__
+
+#include <stddef.h>
+
+/**
+ * Allocator hooks used by libmosaic.
+ *
+ * Each hook receives the allocator's `userdata`, and must behave like its
+ * standard counterpart.
+ */
+typedef struct {
+	void *(*malloc)(size_t size, void *userdata);	///< `malloc` replacement
+	void *(*realloc)(void *ptr, size_t size, void *userdata);	///< `realloc` replacement
+	void (*free)(void *ptr, void *userdata);	///< `free` replacement
+	void *userdata;	///< opaque pointer passed to the hooks
+} mos_allocator;
+
+/**
+ * Set the global allocator.
+ *
+ * @warning Change it only when no memory allocated by libmosaic is alive,
+ * as it'll be released with the new hooks.
+ *
+ * @param[in] allocator The new allocator, which is copied, or NULL to
+ *                      restore the standard one.
+ */
+void mos_set_allocator(const mos_allocator *allocator);
+
+/**
+ * Arena allocator: memory is handed out sequentially from big chunks and
+ * released all at once by @ref mos_arena_free.
+ */
+typedef struct mos_arena mos_arena;
+
+/// Default chunk size for arenas, used when 0 is passed to @ref mos_arena_new
+#define MOS_ARENA_DEFAULT_CHUNK 65536
+
+/**
+ * Create a new arena, with chunks allocated through the global allocator.
+ *
+ * @param[in] chunk_size Size of each chunk, 0 for @ref MOS_ARENA_DEFAULT_CHUNK.
+ *
+ * @return The new arena
+ * @return NULL if allocation failed
+ */
+mos_arena *mos_arena_new(size_t chunk_size);
+
+/**
+ * Release every bit of memory drawn from the arena, and the arena itself.
+ *
+ * MOSAICs created in the arena are no longer valid after this. It is safe
+ * to pass a NULL pointer here.
+ */
+void mos_arena_free(mos_arena *arena);
+
+/**
+ * Forget every allocation from the arena, but keep its chunks for reuse.
+ *
+ * MOSAICs created in the arena are no longer valid after this.
+ */
+void mos_arena_reset(mos_arena *arena);
+
+#endif
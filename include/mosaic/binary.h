@@ -0,0 +1,204 @@
+/*
+ * Copyright 2017 Gil Barbosa Reis <gilzoide@gmail.com>
+ * This file is part of libmosaic.
+ * 
+ * Libmosaic is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Libmosaic is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libmosaic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Any bugs should be reported to <gilzoide@gmail.com>
+ */
+
+/** @file binary.h
+ * The .mosb binary container, a sibling of .mosi files made for loading
+ * fast: no text to parse, and both planes compressed.
+ *
+ * Rows are stored in blocks of a fixed number of rows, each block's chars
+ * then attributes encoded with any @ref mos_attr_storage_fmt, separately.
+ * An index right after the header tells where each block is, so blocks can
+ * be found without reading the ones before them.
+ *
+ * Every number is little endian. The header is 32 bytes:
+ *
+ * | Offset | Size | Field                                                |
+ * | ------ | ---- | ---------------------------------------------------- |
+ * | 0      | 4    | Magic, "MOSB"                                        |
+ * | 4      | 1    | Version, @ref MOS_BINARY_VERSION                     |
+ * | 5      | 1    | Chars format, a @ref mos_attr_storage_fmt            |
+ * | 6      | 1    | Attributes format, a @ref mos_attr_storage_fmt       |
+ * | 7      | 1    | Reserved, 0                                          |
+ * | 8      | 4    | Height                                               |
+ * | 12     | 4    | Width                                                |
+ * | 16     | 4    | Rows per block, the last block may have less         |
+ * | 20     | 4    | Number of blocks                                     |
+ * | 24     | 8    | Checksum of the header's first 24 bytes and the index |
+ *
+ * Then comes the index, 24 bytes for each block:
+ *
+ * | Offset | Size | Field                                                |
+ * | ------ | ---- | ---------------------------------------------------- |
+ * | 0      | 8    | Offset of the block's data from the header's start   |
+ * | 8      | 4    | Size of the block's encoded chars                    |
+ * | 12     | 4    | Size of the block's encoded attributes               |
+ * | 16     | 8    | Checksum of the block's chars and attributes, decoded |
+ *
+ * And then the blocks' data, in order.
+ */
+
+#ifndef __MOSAIC_BINARY_H__
+#define __MOSAIC_BINARY_H__
+
+#include "image.h"
+#include "io.h"
+
+#include <stdio.h>
+
+/// Version of the .mosb files written, newer ones can't be read
+#define MOS_BINARY_VERSION 1
+
+/**
+ * Reads a .mosb image from the stream pointed to by stream, replacing
+ * image's contents.
+ *
+ * Stream is read sequentially, so it doesn't need to be seekable, and is
+ * left right after the image's data.
+ *
+ * @param[out] image  The image to be loaded onto
+ * @param[in]  stream The stream to be read from
+ *
+ * @return @ref MOS_OK on success.
+ * @return @ref MOS_EMALLOC on allocation errors.
+ * @return @ref MOS_ETRUNCATED if the stream ends before the image does.
+ * @return @ref MOS_ECORRUPT if it isn't a .mosb image, or checksums don't match.
+ * @return @ref MOS_EUNKNSTRGFMT if a plane's format is unknown.
+ * @return @ref MOS_EUNSUPPORTED if the version is newer than this library's,
+ *         a plane's format is not supported, or if image is tiled.
+ */
+int mos_binary_fget(MOSAIC *image, FILE *stream);
+
+/**
+ * Reads a rectangle of a .mosb image from the stream pointed to by stream,
+ * replacing image's contents with it.
+ *
+ * Only the row blocks with the rectangle's rows are read, seeking to them
+ * through the index. Planes stored as @ref MOS_UNCOMPRESSED are read right
+ * into image, only the rectangle's columns; other planes have their blocks
+ * decoded whole, one at a time. Checksums are checked only for blocks
+ * decoded whole.
+ *
+ * @param[out] image  The image to be loaded onto, resized to the rectangle,
+ *                    clipped to the stored image
+ * @param[in]  stream The stream to be read from, which must be seekable
+ * @param[in]  y      Upper-left Y coordinate of the rectangle
+ * @param[in]  x      Upper-left X coordinate of the rectangle
+ * @param[in]  height Rectangle's height
+ * @param[in]  width  Rectangle's width
+ *
+ * @return @ref mos_binary_fget results, and
+ * @return @ref MOS_EUNSUPPORTED if stream is not seekable.
+ */
+int mos_binary_fget_region(MOSAIC *image, FILE *stream, int y, int x, int height, int width);
+
+/**
+ * Writes image in the stream pointed to by stream, as .mosb.
+ *
+ * Seekable streams get the index filled in after the blocks are written;
+ * other streams get every block encoded twice, first only to build the
+ * index.
+ *
+ * @param[in]  image    The image to be saved
+ * @param[in]  char_fmt Format of the chars
+ * @param[in]  attr_fmt Format of the attributes
+ * @param[in]  level    Compression level, see @ref mos_fput_level
+ * @param[out] stream   The stream to be written to
+ *
+ * @return @ref MOS_OK on success.
+ * @return @ref MOS_EMALLOC on allocation errors.
+ * @return @ref MOS_EUNKNSTRGFMT if an unknown format is passed, nothing is
+ *         written then.
+ * @return @ref MOS_ECOMPRESSION on compression error.
+ * @return @ref MOS_EUNSUPPORTED if a format is not supported, or if image is
+ *         tiled.
+ */
+int mos_binary_fput(const MOSAIC *image, mos_attr_storage_fmt char_fmt
+		, mos_attr_storage_fmt attr_fmt, int level, FILE *stream);
+
+/**
+ * Loads a .mosb image from a file by its name
+ *
+ * @param[out] image The image to be loaded onto
+ * @param[in] file_name The file name
+ *
+ * @return _errno_ on FILE failure.
+ * @return @ref mos_binary_fget result otherwise.
+ */
+int mos_binary_load(MOSAIC *image, const char *file_name);
+
+/**
+ * Loads a .mosb image from a file by its name, lazily: only the header and
+ * index are read now, and each row block is decoded the first time any of
+ * its rows is accessed, through the get/set functions, any other function
+ * taking a MOSAIC or @ref mos_touch_rows.
+ *
+ * The file is kept open until every block has been decoded or image is
+ * released. Resizing, scrolling or cloning image decodes every pending
+ * block first.
+ *
+ * @note Raw `image->mosaic[y]` and `image->attr[y]` accesses can't be
+ * noticed, so call @ref mos_touch_rows on the rows before using them.
+ *
+ * @param[out] image     The image to be loaded onto, which must not be
+ *                       tiled nor drawn from an arena
+ * @param[in]  file_name The file name
+ *
+ * @return _errno_ on FILE failure.
+ * @return @ref MOS_OK on success.
+ * @return @ref MOS_EMALLOC on allocation errors.
+ * @return @ref MOS_ETRUNCATED if the file is shorter than its index says.
+ * @return @ref MOS_ECORRUPT if the header or index are corrupted.
+ * @return @ref MOS_EUNSUPPORTED if the file is not seekable, or if image is
+ *         tiled or drawn from an arena.
+ */
+int mos_binary_load_lazy(MOSAIC *image, const char *file_name);
+
+/**
+ * Decode the pending row blocks of a lazily loaded image with rows in
+ * [y, y + height), see @ref mos_binary_load_lazy.
+ *
+ * Blocks that fail to decode are left blank. It does nothing on images not
+ * lazily loaded, or whose blocks have all been decoded.
+ *
+ * @param[in] image  Target MOSAIC, which may be a subMOSAIC or view
+ * @param[in] y      First row
+ * @param[in] height Number of rows, clipped to image's boundaries
+ *
+ * @return @ref MOS_OK on success.
+ * @return @ref mos_binary_fget errors for blocks that failed to decode.
+ */
+int mos_touch_rows(MOSAIC *image, int y, int height);
+
+/**
+ * Saves the image in a .mosb file by its name
+ *
+ * @param[in] image The image to be saved
+ * @param[in] char_fmt Format of the chars
+ * @param[in] attr_fmt Format of the attributes
+ * @param[in] level Compression level, see @ref mos_fput_level
+ * @param[in] file_name The new file name
+ *
+ * @return _errno_ on FILE failure.
+ * @return @ref mos_binary_fput result otherwise.
+ */
+int mos_binary_save(MOSAIC *image, mos_attr_storage_fmt char_fmt
+		, mos_attr_storage_fmt attr_fmt, int level, const char *file_name);
+
+#endif
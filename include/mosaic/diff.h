@@ -0,0 +1,109 @@
+/*
+ * Copyright 2017 Gil Barbosa Reis <gilzoide@gmail.com>
+ * This file is part of libmosaic.
+ * 
+ * Libmosaic is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Libmosaic is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libmosaic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Any bugs should be reported to <gilzoide@gmail.com>
+ */
+
+/** @file diff.h
+ * Change-sets between MOSAICs: compute them with @ref mos_diff, apply them
+ * with @ref mos_patch, and save/load them with @ref mos_delta_fput and
+ * @ref mos_delta_fget.
+ *
+ * A @ref mos_delta is a list of runs of changed cells, each with its new
+ * chars and attributes, so it's usually much smaller than the MOSAIC
+ * itself. Deltas keep their buffers between uses, so diffing frame after
+ * frame into the same one doesn't allocate once it's big enough.
+ */
+
+#ifndef __MOSAIC_DIFF_H__
+#define __MOSAIC_DIFF_H__
+
+#include "image.h"
+
+/**
+ * A run of changed cells in a row.
+ */
+typedef struct {
+	int y;	///< row
+	int x;	///< first column
+	int width;	///< number of cells
+	int offset;	///< where the run's cells are in @ref mos_delta::mosaic/attr
+} mos_run;
+
+/**
+ * Change-set that turns a MOSAIC into another.
+ */
+typedef struct {
+	int height;	///< height of the resulting MOSAIC
+	int width;	///< width of the resulting MOSAIC
+	int count;	///< number of runs
+	int capacity;	///< number of runs there's room for
+	mos_run *runs;	///< the runs, top to bottom, left to right
+	int size;	///< number of cells in all runs
+	int cell_capacity;	///< number of cells there's room for
+	mos_char *mosaic;	///< chars of all runs, back to back
+	mos_attr *attr;	///< attributes of all runs, back to back
+} mos_delta;
+
+/**
+ * Create a new empty @ref mos_delta.
+ *
+ * @return The delta on success
+ * @return NULL if allocation failed
+ */
+mos_delta *mos_delta_new(void);
+
+/**
+ * Destroy a delta, deallocating the memory used.
+ *
+ * It is safe to pass a NULL pointer here.
+ */
+void mos_delta_free(mos_delta *delta);
+
+/**
+ * Compute the changes from `from` to `to`, replacing what was in delta.
+ *
+ * Rows are compared a vector at a time, so unchanged rows cost little.
+ * Changed cells closer than a few columns to each other are coalesced in
+ * a single run, as a run's header costs more than that. If `to` is bigger
+ * than `from`, its cells outside it are compared to blank ones, as that's
+ * what resizing `from` exposes.
+ *
+ * @param[out] delta Delta to store the changes
+ * @param[in]  from  MOSAIC the changes apply to
+ * @param[in]  to    MOSAIC the changes lead to
+ *
+ * @return @ref MOS_OK on success
+ * @return @ref MOS_EMALLOC on allocation errors
+ */
+int mos_diff(mos_delta *delta, const MOSAIC *from, const MOSAIC *to);
+
+/**
+ * Apply the changes in delta to img, which should be equal to the `from`
+ * MOSAIC they were computed from. img is resized first if needed.
+ *
+ * @param[in,out] img   MOSAIC to be changed
+ * @param[in]     delta The changes
+ *
+ * @return @ref MOS_OK on success
+ * @return @ref MOS_EMALLOC on allocation errors
+ * @return @ref MOS_EUNSUPPORTED if img would need resizing, but it's a
+ *         subMOSAIC or view
+ */
+int mos_patch(MOSAIC *img, const mos_delta *delta);
+
+#endif
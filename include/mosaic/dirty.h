@@ -0,0 +1,99 @@
+/*
+ * Copyright 2017 Gil Barbosa Reis <gilzoide@gmail.com>
+ * This file is part of libmosaic.
+ * 
+ * Libmosaic is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Libmosaic is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libmosaic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Any bugs should be reported to <gilzoide@gmail.com>
+ */
+
+/** @file dirty.h
+ * Dirty tracking: which cells of a MOSAIC changed since last checked.
+ *
+ * When enabled, every write through the library functions (set, fill,
+ * copy, blit, scroll, trim, resize, load) records the changed columns of
+ * each row, so that renderers and serializers may process only those.
+ * Writes through subMOSAICs and views are recorded in their parent, which
+ * owns the dirty set.
+ *
+ * Ranges are conservative: each row keeps a single column range covering
+ * all its changes, so some cells inside it may not have changed at all.
+ *
+ * @warning Direct writes to `img->mosaic[y][x]` or `img->attr[y][x]` are
+ * not tracked.
+ */
+
+#ifndef __MOSAIC_DIRTY_H__
+#define __MOSAIC_DIRTY_H__
+
+#include "image.h"
+
+/**
+ * Enable or disable dirty tracking of a MOSAIC, or of its parent if it's a
+ * subMOSAIC or view. Tracking starts with everything clean.
+ *
+ * @param[in] img    Target MOSAIC
+ * @param[in] enable Boolean: should changes be tracked?
+ *
+ * @return @ref MOS_OK on success
+ * @return @ref MOS_EMALLOC on allocation errors
+ */
+int mos_track_dirty(MOSAIC *img, int enable);
+
+/**
+ * Checks whether any cell of a MOSAIC changed since the dirty set was last
+ * cleared.
+ *
+ * @return 1 if there are dirty cells
+ * @return 0 otherwise, or if img's changes are not tracked
+ */
+int mos_is_dirty(const MOSAIC *img);
+
+/**
+ * Get the changed column range of a row.
+ *
+ * @param[in]  img   Target MOSAIC
+ * @param[in]  y     Y coordinate
+ * @param[out] x     First dirty column
+ * @param[out] width Number of columns from x on that may have changed
+ *
+ * @return 1 if the row has dirty cells
+ * @return 0 otherwise, in which case the outputs are untouched
+ */
+int mos_dirty_row(const MOSAIC *img, int y, int *x, int *width);
+
+/**
+ * Find the smallest rectangle containing all dirty cells of a MOSAIC.
+ *
+ * @param[in]  img    Target MOSAIC
+ * @param[out] y      Upper-left Y coordinate of the rectangle
+ * @param[out] x      Upper-left X coordinate of the rectangle
+ * @param[out] height Rectangle's height
+ * @param[out] width  Rectangle's width
+ *
+ * @return 1 if there are dirty cells
+ * @return 0 otherwise, in which case the outputs are untouched
+ */
+int mos_dirty_bbox(const MOSAIC *img, int *y, int *x, int *height, int *width);
+
+/**
+ * Mark every cell of a MOSAIC as clean.
+ *
+ * For subMOSAICs and views, only the parent's cells inside them are
+ * cleared; a row range that spans beyond both sides of them is kept, as
+ * ranges can't be split.
+ */
+void mos_clear_dirty(MOSAIC *img);
+
+#endif
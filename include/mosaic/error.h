@@ -41,6 +41,10 @@ typedef enum {
 	MOS_ECOMPRESSION  = -4,
 	/// Unsupported operation.
 	MOS_EUNSUPPORTED  = -5,
+	/// Data ended before expected when reading, or didn't fit the output buffer when writing.
+	MOS_ETRUNCATED    = -6,
+	/// Data read from file is malformed.
+	MOS_ECORRUPT      = -7,
 } mos_error;
 
 /**
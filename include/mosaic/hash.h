@@ -0,0 +1,94 @@
+/*
+ * Copyright 2017 Gil Barbosa Reis <gilzoide@gmail.com>
+ * This file is part of libmosaic.
+ * 
+ * Libmosaic is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Libmosaic is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libmosaic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Any bugs should be reported to <gilzoide@gmail.com>
+ */
+
+/** @file hash.h
+ * 64-bit hashes of MOSAICs and their rows, for fast equality checks and
+ * cache keys.
+ *
+ * Hashes depend only on the contents, both chars and attributes, and on
+ * the dimensions: not on storage, so dense, tiled, cloned and view MOSAICs
+ * with the same cells hash the same.
+ *
+ * Row hashes may be cached in a MOSAIC with @ref mos_track_hashes. Writes
+ * through the library functions mark the changed rows' hashes as stale,
+ * and they're recomputed only when asked for, so hashing a MOSAIC again
+ * after a few changes costs little.
+ *
+ * @warning Direct writes to `img->mosaic[y][x]` or `img->attr[y][x]` don't
+ * mark hashes as stale.
+ */
+
+#ifndef __MOSAIC_HASH_H__
+#define __MOSAIC_HASH_H__
+
+#include "image.h"
+
+#include <stdint.h>
+
+/**
+ * Enable or disable caching of row hashes of a MOSAIC, or of its parent if
+ * it's a subMOSAIC or view.
+ *
+ * @param[in] img    Target MOSAIC
+ * @param[in] enable Boolean: should row hashes be cached?
+ *
+ * @return @ref MOS_OK on success
+ * @return @ref MOS_EMALLOC on allocation errors
+ */
+int mos_track_hashes(MOSAIC *img, int enable);
+
+/**
+ * Hash of a MOSAIC's row, chars and attributes.
+ *
+ * Cached hashes are used if img's row hashes are tracked, and it's not a
+ * subMOSAIC or view narrower than its parent.
+ *
+ * @param[in] img Target MOSAIC
+ * @param[in] y   Y coordinate
+ *
+ * @return The row's hash, never 0
+ */
+uint64_t mos_row_hash(const MOSAIC *img, int y);
+
+/**
+ * Hash of a whole MOSAIC: its dimensions and all row hashes.
+ *
+ * Takes O(height) if row hashes are tracked and up to date.
+ *
+ * @param[in] img Target MOSAIC
+ *
+ * @return The hash, never 0
+ */
+uint64_t mos_hash(const MOSAIC *img);
+
+/**
+ * Checks whether two MOSAICs have the same dimensions, chars and
+ * attributes.
+ *
+ * If both have their row hashes tracked, they're compared first, so that
+ * different MOSAICs are told apart in O(height). Equal ones are still
+ * compared cell by cell, as hashes may collide.
+ *
+ * @return 1 if they're equal
+ * @return 0 otherwise
+ */
+int mos_equal(const MOSAIC *a, const MOSAIC *b);
+
+#endif
@@ -25,8 +25,11 @@
 #ifndef __MOSAIC_IMAGE_H__
 #define __MOSAIC_IMAGE_H__
 
+#include "alloc.h"
 #include "attr.h"
 
+#include <stdarg.h>
+
 /**
  * Char representation inside a MOSAIC.
  */
@@ -34,13 +37,46 @@ typedef char mos_char;
 
 /**
  * "Image" in MOSAIC format.
+ *
+ * Both planes are stored contiguously: @ref MOSAIC::mosaic and
+ * @ref MOSAIC::attr are row pointers into a single block, so the usual
+ * `img->mosaic[y][x]` access still works, with rows laid side by side in
+ * memory.
+ *
+ * Row pointers may be rotated when scrolling (see @ref mos_scroll), so row
+ * `y` is not necessarily the y-th one in the block.
+ *
+ * SubMOSAICs' row pointers point into their parent's rows, and are updated
+ * whenever those move: when the parent is scrolled, resized, or copies
+ * rows it shared with a clone.
+ *
+ * @note Views (see @ref mos_view) have no row pointers at all, use the
+ * get/set functions with them. Neither are row pointers of SubMOSAICs kept
+ * up to date if they're in a different arena than their parent.
  */
-typedef struct {
+typedef struct MOSAIC {
 	int height;	///< img height
 	int	width;	///< img width
 	mos_char **mosaic;		///< a height * width sized string: the drawing itself
 	mos_attr **attr;	///< a height * width sized array with the attributes for each char
+	int capacity_height;	///< rows reserved in data, at least height
+	int capacity_width;	///< columns reserved in data, at least width; it's also the row stride
+	mos_char *data;	///< contiguous block holding both planes, maybe shared with clones (NULL for subMOSAICs)
+	mos_char *cow_data;	///< block with the rows copied out of shared blocks when written to
+	int row_offset;	///< where mosaic/attr start in their row pointer rings, moved when scrolling
+	struct MOSAIC *parent;	///< MOSAIC a subMOSAIC/view refers to, NULL otherwise
+	mos_arena *arena;	///< arena the MOSAIC's memory is drawn from, NULL for the global allocator
+	struct mos_tiles *tiles;	///< tile grid of tiled MOSAICs (see tile.h), NULL otherwise
+	struct mos_dirty *dirty;	///< changed cells (see dirty.h), NULL if not tracked
+	struct mos_hashes *hashes;	///< cached row hashes (see hash.h), NULL if not tracked
+	struct mos_lazy *lazy;	///< row blocks yet to be decoded (see binary.h), NULL unless lazily loaded
+	struct MOSAIC *submosaics;	///< first of the subMOSAICs pointing into its rows, linked through next_sub
+	struct MOSAIC *next_sub;	///< next subMOSAIC of the same parent
+	int begin_y;	///< upper-left Y coordinate of a subMOSAIC/view inside parent
+	int begin_x;	///< upper-left X coordinate of a subMOSAIC/view inside parent
 	unsigned char is_sub : 1;	///< boolean: is it a subMOSAIC?
+	unsigned char is_shared : 1;	///< boolean: may it share rows with a clone?
+	unsigned char is_tracked : 1;	///< boolean: is it in its parent's subMOSAIC list?
 } MOSAIC;
 
 /// Default attribute for Mosaics: white on black
@@ -59,6 +95,22 @@ typedef struct {
  */
 MOSAIC *mos_new(int height, int width);
 
+/**
+ * Create a new @ref MOSAIC inside an arena.
+ *
+ * Everything the MOSAIC ever allocates, including when resized, is drawn
+ * from the arena, and released only with it. There's no need to call
+ * @ref mos_free on it, though doing so is harmless.
+ *
+ * @param[in] arena  Arena to allocate from, NULL for the global allocator
+ * @param[in] height New MOSAIC's height
+ * @param[in] width  New MOSAIC's width
+ *
+ * @return A MOSAIC on success
+ * @return NULL if allocation failed
+ */
+MOSAIC *mos_new_in(mos_arena *arena, int height, int width);
+
 /**
  * Destroy an image, deallocating the memory used.
  *
@@ -113,6 +165,65 @@ mos_char mos_set_char(MOSAIC *img, int y, int x, mos_char c);
  */
 mos_attr mos_set_attr(MOSAIC *img, int y, int x, mos_attr a);
 
+/**
+ * Write a string into a row, starting at position y/x, all with the same
+ * attribute.
+ *
+ * The string is clipped to img's boundaries once, and copied at once.
+ * Chars are written as they are, even newlines.
+ *
+ * @param[in] img Target MOSAIC
+ * @param[in] y   Y coordinate
+ * @param[in] x   X coordinate, may be negative to cut the string's start
+ * @param[in] str NUL terminated string
+ * @param[in] a   Attribute for the written chars
+ *
+ * @return The number of chars written
+ */
+int mos_set_str(MOSAIC *img, int y, int x, const char *str, mos_attr a);
+
+/**
+ * Write n cells into a row, starting at position y/x, from parallel arrays
+ * of chars and attributes.
+ *
+ * The cells are clipped to img's boundaries once, and copied at once.
+ *
+ * @param[in] img   Target MOSAIC
+ * @param[in] y     Y coordinate
+ * @param[in] x     X coordinate, may be negative to cut the arrays' start
+ * @param[in] chars Chars to be written, or NULL to keep the current ones
+ * @param[in] attrs Attributes to be written, or NULL to keep the current ones
+ * @param[in] n     Number of cells in the arrays
+ *
+ * @return The number of cells written
+ */
+int mos_set_cells(MOSAIC *img, int y, int x, const mos_char *chars, const mos_attr *attrs, int n);
+
+/**
+ * Write formatted output into a row, starting at position y/x, all with the
+ * same attribute, `printf` style.
+ *
+ * Only what fits in the row is formatted, then written at once.
+ *
+ * @param[in] img Target MOSAIC
+ * @param[in] y   Y coordinate
+ * @param[in] x   X coordinate, may be negative to cut the output's start
+ * @param[in] a   Attribute for the written chars
+ * @param[in] fmt `printf` format string
+ *
+ * @return The number of chars written
+ */
+int mos_printf(MOSAIC *img, int y, int x, mos_attr a, const char *fmt, ...)
+#ifdef __GNUC__
+	__attribute__((format(printf, 5, 6)))
+#endif
+	;
+
+/**
+ * @ref mos_printf with a `va_list`.
+ */
+int mos_vprintf(MOSAIC *img, int y, int x, mos_attr a, const char *fmt, va_list args);
+
 /**
  * Get the char at position y/x
  *
@@ -153,6 +264,20 @@ void mos_fill_char(MOSAIC *img, mos_char c);
  * @param[in] a   Attribute for filling.
  */
 void mos_fill_attr(MOSAIC *img, mos_attr a);
+/**
+ * Fill a rectangle of a MOSAIC with the same character and attribute.
+ *
+ * The rectangle is clipped to img's boundaries.
+ *
+ * @param[in] img    Target MOSAIC.
+ * @param[in] y      The upper-left Y coordinate of the rectangle
+ * @param[in] x      The upper-left X coordinate of the rectangle
+ * @param[in] height Rectangle's height
+ * @param[in] width  Rectangle's width
+ * @param[in] c      Character for filling.
+ * @param[in] a      Attribute for filling.
+ */
+void mos_fill_rect(MOSAIC *img, int y, int x, int height, int width, mos_char c, mos_attr a);
 /**
  * Erase a MOSAIC's contents with the default values.
  *
@@ -169,6 +294,12 @@ void mos_erase(MOSAIC *img);
  * @note Freeing a SubMOSAIC before or after it's relative doesn't make a
  * difference, as the actual content will be freed only from the relative MOSAIC
  *
+ * @note The SubMOSAIC's own row pointers follow the parent's rows when they
+ * move, except if the SubMOSAIC is in a different arena than the parent:
+ * then they are a snapshot, and after the parent is resized, scrolled or
+ * unshared, the get/set functions must be used, as they always go through
+ * the parent. Rows outside the parent's storage after it shrinks are NULL.
+ *
  * @param[in] parent  The outter MOSAIC
  * @param[in] height  Inner MOSAIC's height
  * @param[in] width   Inner MOSAIC's width
@@ -176,12 +307,60 @@ void mos_erase(MOSAIC *img);
  * @param[in] begin_x The upper-left X coordinate, where inner MOSAIC begins
  *
  * @return SubMOSAIC
- * @return NULL on allocation errors
+ * @return NULL on allocation errors, or if parent is tiled
  */
 MOSAIC *mos_submosaic(MOSAIC *parent, int height, int width, int begin_y, int begin_x);
 
+/**
+ * Gets a SubMOSAIC allocated inside an arena.
+ *
+ * @see mos_submosaic
+ *
+ * @param[in] arena   Arena to allocate from, NULL for the global allocator
+ * @param[in] parent  The outter MOSAIC
+ * @param[in] height  Inner MOSAIC's height
+ * @param[in] width   Inner MOSAIC's width
+ * @param[in] begin_y The upper-left Y coordinate, where inner MOSAIC begins
+ * @param[in] begin_x The upper-left X coordinate, where inner MOSAIC begins
+ *
+ * @return SubMOSAIC
+ * @return NULL on allocation errors, or if parent is tiled
+ */
+MOSAIC *mos_submosaic_in(mos_arena *arena, MOSAIC *parent, int height, int width, int begin_y, int begin_x);
+
+/**
+ * Gets a view of a MOSAIC: a SubMOSAIC that doesn't allocate anything.
+ *
+ * The view is returned by value, so it can live on the stack or be embedded
+ * in another struct. Cells are addressed through the parent's rows using the
+ * view's origin, so it stays valid if the parent is resized, and works with
+ * every get/set/fill/copy function.
+ *
+ * @note Views have no row pointers of their own: `view.mosaic` and
+ * `view.attr` are NULL.
+ *
+ * @note Views must NOT be passed to @ref mos_free, as there's nothing to free.
+ *
+ * @param[in] parent  The outter MOSAIC
+ * @param[in] height  View's height
+ * @param[in] width   View's width
+ * @param[in] begin_y The upper-left Y coordinate, where the view begins
+ * @param[in] begin_x The upper-left X coordinate, where the view begins
+ *
+ * @return The view
+ */
+MOSAIC mos_view(MOSAIC *parent, int height, int width, int begin_y, int begin_x);
+
 /**
  * Resize a @ref MOSAIC, reallocating the necessary memory
+ *
+ * The MOSAIC keeps a reserved capacity apart from its dimensions: shrinking
+ * never frees anything and growing inside the capacity only blanks the newly
+ * exposed cells. Growing past it relocates the data in a single pass to a
+ * new contiguous block, with some slack for future growth; on failure the
+ * MOSAIC is left untouched.
+ *
+ * @note SubMOSAICs and views can't be resized.
  * 
  * @param[in] img The target MOSAIC
  * @param[in] new_height MOSAIC's new height
@@ -189,9 +368,37 @@ MOSAIC *mos_submosaic(MOSAIC *parent, int height, int width, int begin_y, int be
  * 
  * @return @ref MOS_OK if successfully resized @ref MOSAIC
  * @return @ref MOS_EMALLOC on `malloc` errors
+ * @return @ref MOS_EUNSUPPORTED if img is a subMOSAIC or view
  */
 int mos_resize(MOSAIC *img, int new_height, int new_width);
 
+/**
+ * Reserve capacity for a MOSAIC to be resized up to height x width without
+ * reallocating.
+ *
+ * Dimensions are not changed, and capacity is never reduced.
+ *
+ * @param[in] img    The target MOSAIC
+ * @param[in] height Number of rows to reserve
+ * @param[in] width  Number of columns to reserve
+ *
+ * @return @ref MOS_OK on success
+ * @return @ref MOS_EMALLOC on `malloc` errors
+ * @return @ref MOS_EUNSUPPORTED if img is a subMOSAIC or view
+ */
+int mos_reserve(MOSAIC *img, int height, int width);
+
+/**
+ * Release a MOSAIC's unused capacity, so it's exactly height x width.
+ *
+ * @param[in] img The target MOSAIC
+ *
+ * @return @ref MOS_OK on success
+ * @return @ref MOS_EMALLOC on `malloc` errors
+ * @return @ref MOS_EUNSUPPORTED if img is a subMOSAIC or view
+ */
+int mos_shrink_to_fit(MOSAIC *img);
+
 /**
  * Copy the contents of a MOSAIC, from _src_ to _dest_.
  *
@@ -203,21 +410,102 @@ int mos_resize(MOSAIC *img, int new_height, int new_width);
  */
 void mos_copy(MOSAIC *dest, MOSAIC *src);
 
+/// Key for @ref mos_blit meaning no char is transparent
+#define MOS_NO_KEY -1
+
+/**
+ * Copy a rectangle from _src_ at src_y/src_x to _dest_ at dest_y/dest_x,
+ * leaving cells untouched where _src_'s char is the transparency key.
+ *
+ * The rectangle is clipped to both MOSAICs' boundaries once, and copied row
+ * by row, with vectorized masked copies when there's a key. _src_ and
+ * _dest_ may be the same MOSAIC, or share a parent, even if the rectangles
+ * overlap.
+ *
+ * @param[out] dest   Target MOSAIC
+ * @param[in]  dest_y Upper-left Y coordinate in dest
+ * @param[in]  dest_x Upper-left X coordinate in dest
+ * @param[in]  src    Source MOSAIC
+ * @param[in]  src_y  Upper-left Y coordinate in src
+ * @param[in]  src_x  Upper-left X coordinate in src
+ * @param[in]  height Rectangle's height
+ * @param[in]  width  Rectangle's width
+ * @param[in]  key    Transparent char, as an `unsigned char`, or
+ *                    @ref MOS_NO_KEY to copy everything
+ */
+void mos_blit(MOSAIC *dest, int dest_y, int dest_x
+		, const MOSAIC *src, int src_y, int src_x, int height, int width, int key);
+
+/**
+ * Scroll a MOSAIC's contents in place, blanking what's exposed.
+ *
+ * Scrolling rows of a MOSAIC that owns its data just rotates its row
+ * pointers, costing only the exposed rows, whatever the MOSAIC's size.
+ * Its SubMOSAICs' row pointers are rotated along, and views resolve their
+ * rows through the parent, so both see the scrolled rows.
+ *
+ * @param[in] img     Target MOSAIC
+ * @param[in] lines   Number of rows to scroll up, or down if negative
+ * @param[in] columns Number of columns to scroll left, or right if negative
+ */
+void mos_scroll(MOSAIC *img, int lines, int columns);
+
 /**
- * Clone a MOSAIC, deep copying it's contents.
+ * Clone a MOSAIC, sharing it's contents copy-on-write.
+ *
+ * The clone shares row storage with `src` under a reference count, and rows
+ * are copied only when written to, by either of them, through the set,
+ * fill, copy, resize and trim functions. This makes snapshots cheap.
+ *
+ * @note Writing directly to `img->mosaic[y][x]` of a shared MOSAIC would
+ * change its clones too, so call @ref mos_unshare before doing so.
+ *
+ * @note SubMOSAICs, views and arena MOSAICs are deep copied.
  *
  * @param[in] src Source MOSAIC
  *
  * @return `src` clone
+ * @return NULL on allocation errors
  */
 MOSAIC *mos_clone(MOSAIC *src);
 
+/**
+ * Make a MOSAIC stop sharing rows with its clones, by copying them all.
+ *
+ * After that, `img->mosaic[y][x]` may be written to directly, until it's
+ * cloned again. For SubMOSAICs and views, their parent is unshared, and
+ * SubMOSAICs' row pointers then point to its private rows.
+ *
+ * @param[in] img Target MOSAIC
+ *
+ * @return @ref MOS_OK on success
+ * @return @ref MOS_EMALLOC on allocation errors
+ */
+int mos_unshare(MOSAIC *img);
+
+/**
+ * Find the smallest rectangle containing all non blank chars of a MOSAIC.
+ *
+ * Blank chars are the @ref MOS_DEFAULT_CHAR ones, and attributes don't
+ * matter. Rows are scanned from both ends with SIMD when available.
+ *
+ * @param[in]  img    Target MOSAIC
+ * @param[out] y      Upper-left Y coordinate of the rectangle
+ * @param[out] x      Upper-left X coordinate of the rectangle
+ * @param[out] height Rectangle's height
+ * @param[out] width  Rectangle's width
+ *
+ * @return 1 if there's any non blank char
+ * @return 0 if img is all blank, in which case the outputs are untouched
+ */
+int mos_bbox(const MOSAIC *img, int *y, int *x, int *height, int *width);
+
 /**
  * Trim a MOSAIC's blank area in each side of target
  *
- * @note Resizing the image may be expensive, so think carefully about it. If
- * not resizing, it'll just shift the image, as if you copied the rectangle
- * with the mosaic and pasted it at (0,0).
+ * @note Resizing only shrinks the dimensions, keeping the capacity (see
+ * @ref mos_shrink_to_fit). If not resizing, it'll just shift the image, as
+ * if you copied the rectangle with the mosaic and pasted it at (0,0).
  *
  * @param[in] target Target MOSAIC
  * @param[in] resize Bool: sould we resize the mosaic?
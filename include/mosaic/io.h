@@ -37,15 +37,31 @@
 #ifndef __MOSAIC_IO_H_
 #define __MOSAIC_IO_H_
 
+#include "diff.h"
 #include "image.h"
 
 #include <stdio.h>
 
-/// Attribute storage format
+/**
+ * Attribute storage format
+ *
+ * @ref MOS_RLE packs the attributes, row after row, into packets: a header
+ * byte, whose high bit tells a run (set) from a literal (unset), with its
+ * length in the other bits. Lengths of 1 to 127 are stored as length - 1;
+ * the value 127 means 128 plus an unsigned LEB128 number that follows. A run
+ * has a single attribute byte after the length, a literal has that many.
+ *
+ * @ref MOS_COMPRESSED, @ref MOS_ZSTD and @ref MOS_LZ4 are supported only if
+ * libmosaic was built with zlib, zstd or lz4, respectively. Their data is
+ * preceded by its size, a native `size_t`.
+ */
 typedef enum {
 	MOS_NO_ATTR = '.',      ///< No attributes in this file, so load it all as MOS_DEFAULT_ATTR
 	MOS_UNCOMPRESSED = 'U', ///< Binary part not compressed
 	MOS_COMPRESSED = 'C',   ///< Binary part compressed with zlib
+	MOS_RLE = 'R',          ///< Binary part run-length encoded, always supported
+	MOS_ZSTD = 'Z',         ///< Binary part compressed with zstd
+	MOS_LZ4 = 'L',          ///< Binary part compressed with lz4, in a frame
 } mos_attr_storage_fmt;
 
 /**
@@ -62,7 +78,10 @@ typedef enum {
  * @return @ref MOS_ENODIMENSIONS if no dimensions are present.
  * @return @ref MOS_EUNKNSTRGFMT if unknown format is found.
  * @return @ref MOS_ECOMPRESSION on compression error.
- * @return @ref MOS_EUNSUPPORTED if compression is not supported.
+ * @return @ref MOS_ETRUNCATED if compressed or encoded attributes are cut short.
+ * @return @ref MOS_ECORRUPT if compressed or encoded attributes are invalid.
+ * @return @ref MOS_EUNSUPPORTED if compression is not supported, or if
+ *         image is tiled.
  */
 int mos_fget(MOSAIC *image, FILE *stream);
 
@@ -76,10 +95,191 @@ int mos_fget(MOSAIC *image, FILE *stream);
  * @return @ref MOS_OK on success.
  * @return @ref MOS_EUNKNSTRGFMT if unknown format is passed.
  * @return @ref MOS_ECOMPRESSION on compression error.
- * @return @ref MOS_EUNSUPPORTED if compression is not supported.
+ * @return @ref MOS_EUNSUPPORTED if compression is not supported, or if
+ *         image is tiled.
  */
 int mos_fput(const MOSAIC *image, mos_attr_storage_fmt fmt, FILE *stream);
 
+/// Compression level that picks each codec's own default
+#define MOS_DEFAULT_LEVEL 0
+
+/**
+ * Writes image in the stream pointed to by stream, with a compression level.
+ *
+ * Levels are the codec's own: 1 (fastest) to 9 (smallest) for zlib, up to
+ * 22 for zstd, which also takes negative ones for even faster compression,
+ * and up to 12 for lz4, where negative ones are faster and 3 and over
+ * compress harder but decompress just as fast. Out of range levels are
+ * clamped, and formats that aren't compressed ignore it.
+ *
+ * @param[in] image The image to be saved
+ * @param[in] fmt Compression format to be used
+ * @param[in] level Compression level, @ref MOS_DEFAULT_LEVEL for the default
+ * @param[out] stream The stream to be written to
+ *
+ * @return @ref mos_fput results.
+ */
+int mos_fput_level(const MOSAIC *image, mos_attr_storage_fmt fmt, int level, FILE *stream);
+
+/**
+ * Reads image from the `size` bytes at data, exactly as @ref mos_fget
+ * would from a stream with the same bytes.
+ *
+ * The text part is parsed right where it is, and compressed attributes are
+ * decompressed from it with no copies.
+ *
+ * @param[out] image    The image to store what was read
+ * @param[in]  data     The bytes to be read
+ * @param[in]  size     Number of bytes in data
+ * @param[out] consumed Where to store the number of bytes read, the same
+ *                      @ref mos_fget would have read, if not NULL
+ *
+ * @return @ref mos_fget results.
+ */
+int mos_mem_get(MOSAIC *image, const void *data, size_t size, size_t *consumed);
+
+/**
+ * Growable buffer for images written to memory.
+ *
+ * Zero initialize it before first use, and reuse it so it doesn't have to
+ * grow again. Release it with @ref mos_mem_buffer_free.
+ */
+typedef struct {
+	char *data;	///< written bytes
+	size_t length;	///< number of written bytes
+	size_t capacity;	///< number of bytes allocated in data
+} mos_mem_buffer;
+
+/**
+ * Writes image into a caller-supplied buffer, byte for byte as
+ * @ref mos_fput_level would.
+ *
+ * When the buffer is too small, what fits is written, and the whole size
+ * is still stored, so that the call can be repeated with a buffer that
+ * big. Passing a NULL buffer with no capacity only measures it.
+ *
+ * @param[in]  image    The image to be saved
+ * @param[in]  fmt      Compression format to be used
+ * @param[in]  level    Compression level, see @ref mos_fput_level
+ * @param[out] buffer   Where to write to
+ * @param[in]  capacity Size of buffer
+ * @param[out] size     Where to store the number of bytes the image takes
+ *
+ * @return @ref mos_fput results, and
+ * @return @ref MOS_ETRUNCATED if it didn't fit in buffer.
+ */
+int mos_mem_put(const MOSAIC *image, mos_attr_storage_fmt fmt, int level
+		, void *buffer, size_t capacity, size_t *size);
+
+/**
+ * Writes image into a growable buffer, replacing its contents, byte for
+ * byte as @ref mos_fput_level would.
+ *
+ * @param[in]     image  The image to be saved
+ * @param[in]     fmt    Compression format to be used
+ * @param[in]     level  Compression level, see @ref mos_fput_level
+ * @param[in,out] buffer Where to write to
+ *
+ * @return @ref mos_fput results, and
+ * @return @ref MOS_EMALLOC if the buffer couldn't grow.
+ */
+int mos_mem_put_buffer(const MOSAIC *image, mos_attr_storage_fmt fmt, int level
+		, mos_mem_buffer *buffer);
+
+/**
+ * Release a memory buffer's memory, leaving it empty for reuse.
+ */
+void mos_mem_buffer_free(mos_mem_buffer *buffer);
+
+/**
+ * Row-streaming writer: writes a .mosi image a row at a time, without ever
+ * holding it whole in memory.
+ *
+ * The text part is written as rows are pushed. Attributes come after all
+ * of it, so they're spooled to a temporary file and encoded from there
+ * when the writer is finished. The output is the same @ref mos_fput_level
+ * would write for the same image.
+ */
+typedef struct mos_writer mos_writer;
+
+/**
+ * Begin writing an image to the stream pointed to by stream, a row at a
+ * time, writing its dimensions right away.
+ *
+ * @param[out] stream The stream to be written to
+ * @param[in]  height Image height, the number of rows to be pushed
+ * @param[in]  width  Image width, the number of cells in each row
+ * @param[in]  fmt    Compression format to be used for the attributes
+ * @param[in]  level  Compression level, see @ref mos_fput_level
+ * @param[out] error  Where to store the error code, if not NULL:
+ *                    @ref MOS_OK on success, @ref MOS_EMALLOC on allocation
+ *                    errors, @ref MOS_EUNKNSTRGFMT if fmt is unknown,
+ *                    @ref MOS_EUNSUPPORTED if it's not supported or the
+ *                    dimensions are negative, _errno_ if the spool couldn't
+ *                    be created
+ *
+ * @return The writer, to be finished with @ref mos_writer_finish
+ * @return NULL on errors, with nothing written
+ */
+mos_writer *mos_writer_begin(FILE *stream, int height, int width
+		, mos_attr_storage_fmt fmt, int level, int *error);
+
+/**
+ * Write the next row.
+ *
+ * @param[in] writer The writer
+ * @param[in] chars  The row's `width` chars, or NULL for blanks. As with
+ *                   @ref mos_fput, a NUL ends the row's text
+ * @param[in] attrs  The row's `width` attributes, or NULL for
+ *                   @ref MOS_DEFAULT_ATTR
+ *
+ * @return @ref MOS_OK on success
+ * @return @ref MOS_EUNSUPPORTED if every row has already been pushed
+ * @return _errno_ if spooling the attributes failed
+ */
+int mos_writer_push(mos_writer *writer, const mos_char *chars, const mos_attr *attrs);
+
+/**
+ * Finish writing: rows not pushed are written blank, then the attributes
+ * are encoded from the spool. The writer is released, whatever happens.
+ *
+ * @param[in] writer The writer
+ *
+ * @return @ref mos_fput results.
+ * @return _errno_ if spooling the attributes failed, or @ref MOS_ETRUNCATED
+ *         if they couldn't all be read back.
+ */
+int mos_writer_finish(mos_writer *writer);
+
+/**
+ * Reads a delta from the stream pointed to by stream, as written by
+ * @ref mos_delta_fput, replacing what was in delta.
+ *
+ * @param[out] delta  The delta to store what was read
+ * @param[in]  stream The stream to be read from
+ *
+ * @return @ref MOS_OK on success.
+ * @return @ref MOS_EMALLOC on allocation errors.
+ * @return @ref MOS_ENODIMENSIONS if no delta header is present.
+ * @return @ref MOS_ETRUNCATED if the stream ends before all runs were read.
+ * @return @ref MOS_ECORRUPT if a run doesn't fit the dimensions.
+ */
+int mos_delta_fget(mos_delta *delta, FILE *stream);
+
+/**
+ * Writes a delta in the stream pointed to by stream.
+ *
+ * The format mimics .mosi files: a text header `MOSD <height>x<width>
+ * <count>`, then each run's text header `<y>,<x>,<width>`, followed by its
+ * chars and its attributes, both raw.
+ *
+ * @param[in]  delta  The delta to be saved
+ * @param[out] stream The stream to be written to
+ *
+ * @return @ref MOS_OK on success.
+ */
+int mos_delta_fput(const mos_delta *delta, FILE *stream);
+
 /**
  * Saves the image in a file by its name
  * 
@@ -92,6 +292,20 @@ int mos_fput(const MOSAIC *image, mos_attr_storage_fmt fmt, FILE *stream);
  */
 int mos_save(MOSAIC *image, mos_attr_storage_fmt fmt, const char *file_name);
 
+/**
+ * Saves the image in a file by its name, with a compression level, see
+ * @ref mos_fput_level
+ *
+ * @param[in] image The image to be saved
+ * @param[in] fmt Compression format to be used
+ * @param[in] level Compression level, @ref MOS_DEFAULT_LEVEL for the default
+ * @param[in] file_name The new file name
+ *
+ * @return _errno_ on FILE failure.
+ * @return @ref mos_fput_level result otherwise.
+ */
+int mos_save_level(MOSAIC *image, mos_attr_storage_fmt fmt, int level, const char *file_name);
+
 /**
  * Loads the image from a file by its name
  * 
@@ -103,4 +317,68 @@ int mos_save(MOSAIC *image, mos_attr_storage_fmt fmt, const char *file_name);
  */
 int mos_load(MOSAIC *image, const char *file_name);
 
+/**
+ * Loads a new image from a file by its name, mapping it in memory instead
+ * of reading it whenever possible.
+ *
+ * Files with @ref MOS_UNCOMPRESSED or @ref MOS_NO_ATTR attributes are
+ * mapped privately, and the rows of the new image that are full width in
+ * the file point straight into the mapping, as do uncompressed attributes.
+ * Only shorter rows and default attributes are actually allocated, so
+ * loading costs a page fault per page touched, not a full copy.
+ *
+ * The image works as any other: writes to it never reach the file, and the
+ * mapping is released with the image (or with its last clone). Other files,
+ * or if memory mapping is not supported, are loaded with @ref mos_load.
+ *
+ * @warning The file should not be truncated while mapped.
+ *
+ * @param[in]  file_name The file name
+ * @param[out] error     Where to store the @ref mos_load like result, may be
+ *                       NULL
+ *
+ * @return The new image, which is still valid if error is
+ *         @ref MOS_EUNKNSTRGFMT
+ * @return NULL on any other error
+ */
+MOSAIC *mos_load_mapped(const char *file_name, int *error);
+
+/**
+ * Loads a rectangle of the image in a file by its name, .mosi or .mosb,
+ * replacing image's contents with it.
+ *
+ * .mosb files are read with @ref mos_binary_fget_region, so that only the
+ * rectangle's row blocks are read. .mosi files have no index, so they are
+ * loaded with @ref mos_load_mapped and the rectangle is copied out: with
+ * uncompressed attributes, only the pages it covers are actually read.
+ *
+ * @param[out] image     The image to be loaded onto, resized to the
+ *                       rectangle, clipped to the stored image
+ * @param[in]  file_name The file name
+ * @param[in]  y         Upper-left Y coordinate of the rectangle
+ * @param[in]  x         Upper-left X coordinate of the rectangle
+ * @param[in]  height    Rectangle's height
+ * @param[in]  width     Rectangle's width
+ *
+ * @return _errno_ on FILE failure.
+ * @return @ref mos_binary_fget_region or @ref mos_load result otherwise.
+ */
+int mos_load_region(MOSAIC *image, const char *file_name, int y, int x, int height, int width);
+
+/**
+ * Loads the image from a file by its name, .mosi or .mosb, decoding rows
+ * only as they're first accessed when possible.
+ *
+ * .mosb files are loaded with @ref mos_binary_load_lazy, so that loading
+ * takes about the same time whatever the file's size. .mosi files have no
+ * index to find rows by, so they are loaded whole with @ref mos_load.
+ *
+ * @param[out] image     The image to be loaded onto
+ * @param[in]  file_name The file name
+ *
+ * @return _errno_ on FILE failure.
+ * @return @ref mos_binary_load_lazy or @ref mos_load result otherwise.
+ */
+int mos_load_lazy(MOSAIC *image, const char *file_name);
+
 #endif
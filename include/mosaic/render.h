@@ -0,0 +1,171 @@
+/*
+ * Copyright 2017 Gil Barbosa Reis <gilzoide@gmail.com>
+ * This file is part of libmosaic.
+ * 
+ * Libmosaic is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Libmosaic is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libmosaic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Any bugs should be reported to <gilzoide@gmail.com>
+ */
+
+/** @file render.h
+ * Rendering MOSAICs as text for ANSI terminals.
+ *
+ * Colors and modifiers are emitted as SGR escape sequences only when the
+ * attribute changes from a cell to the next, each row ending with a reset
+ * and a newline. Escapes come from a precomputed table with one for each
+ * @ref mos_attr, so rendering is mostly copying.
+ *
+ * For animations, a @ref mos_screen keeps the frame last displayed, and
+ * renders only the cells that changed since then.
+ */
+
+#ifndef __MOSAIC_RENDER_H__
+#define __MOSAIC_RENDER_H__
+
+#include "image.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * Growable buffer for rendered output.
+ *
+ * Zero initialize it before first use, and reuse it between renders so it
+ * doesn't have to grow again. Release it with @ref mos_render_buffer_free.
+ */
+typedef struct {
+	char *data;	///< rendered bytes, not NUL terminated
+	size_t length;	///< number of rendered bytes
+	size_t capacity;	///< number of bytes allocated in data
+} mos_render_buffer;
+
+/**
+ * Render img into a caller-supplied buffer.
+ *
+ * Only whole rows are written, so when the buffer is too small, the output
+ * is cut at the last row that fits.
+ *
+ * @param[in]  img    The image to be rendered
+ * @param[in]  color  Boolean: emit colors and modifiers?
+ * @param[out] buffer Where to render to
+ * @param[in]  size   Size of buffer
+ *
+ * @return The number of bytes rendering the whole img takes, which is
+ *         greater than size if the output was cut
+ */
+size_t mos_render_ansi(const MOSAIC *img, int color, char *buffer, size_t size);
+
+/**
+ * Render img into a growable buffer, replacing its contents.
+ *
+ * @param[in]     img    The image to be rendered
+ * @param[in]     color  Boolean: emit colors and modifiers?
+ * @param[in,out] buffer Where to render to
+ *
+ * @return @ref MOS_OK on success
+ * @return @ref MOS_EMALLOC on allocation errors
+ */
+int mos_render_ansi_buffer(const MOSAIC *img, int color, mos_render_buffer *buffer);
+
+/**
+ * Render img and write it in the stream pointed to by stream, with a
+ * single write.
+ *
+ * @param[in]  img    The image to be rendered
+ * @param[in]  color  Boolean: emit colors and modifiers?
+ * @param[out] stream The stream to be written to
+ *
+ * @return @ref MOS_OK on success
+ * @return @ref MOS_EMALLOC on allocation errors
+ */
+int mos_render_ansi_fput(const MOSAIC *img, int color, FILE *stream);
+
+/**
+ * Release a render buffer's memory, leaving it empty for reuse.
+ */
+void mos_render_buffer_free(mos_render_buffer *buffer);
+
+/**
+ * Differential renderer: remembers what's displayed in a terminal, so
+ * that each frame emits only cursor moves and the cells that changed,
+ * as curses does.
+ *
+ * Frames are drawn from the terminal's top-left corner, and nothing else
+ * should write to the terminal between them, or else call
+ * @ref mos_screen_invalidate.
+ */
+typedef struct mos_screen mos_screen;
+
+/**
+ * Create a new screen, with nothing known to be displayed, so that the
+ * first frame is drawn whole.
+ *
+ * @return The screen on success
+ * @return NULL if allocation failed
+ */
+mos_screen *mos_screen_new(void);
+
+/**
+ * Destroy a screen, deallocating the memory used.
+ *
+ * It is safe to pass a NULL pointer here.
+ */
+void mos_screen_free(mos_screen *screen);
+
+/**
+ * Forget what's displayed, so that the next frame is drawn whole.
+ */
+void mos_screen_invalidate(mos_screen *screen);
+
+/**
+ * Render what changed from the last frame to this one into a growable
+ * buffer, replacing its contents.
+ *
+ * Cursor moves are the cheapest among absolute, relative and carriage
+ * return based ones, or even reprinting the cells in between. SGR escapes
+ * are emitted only when the attribute changes. If the frame's dimensions
+ * changed, the terminal is cleared and the frame drawn whole.
+ *
+ * @param[in,out] screen The screen, updated with frame
+ * @param[in]     frame  The frame to be displayed
+ * @param[in,out] buffer Where to render to, its length being the number
+ *                       of bytes emitted
+ *
+ * @return @ref MOS_OK on success
+ * @return @ref MOS_EMALLOC on allocation errors, in which case the screen
+ *         is invalidated
+ */
+int mos_screen_render(mos_screen *screen, const MOSAIC *frame, mos_render_buffer *buffer);
+
+/**
+ * Render what changed from the last frame to this one, and write it in the
+ * stream pointed to by stream, with a single write.
+ *
+ * @see mos_screen_render
+ *
+ * @param[in,out] screen The screen, updated with frame
+ * @param[in]     frame  The frame to be displayed
+ * @param[out]    stream The stream to be written to
+ *
+ * @return @ref MOS_OK on success
+ * @return @ref MOS_EMALLOC on allocation errors
+ */
+int mos_screen_fput(mos_screen *screen, const MOSAIC *frame, FILE *stream);
+
+/**
+ * Number of bytes emitted for the last frame rendered by a screen.
+ */
+size_t mos_screen_bytes(const mos_screen *screen);
+
+#endif
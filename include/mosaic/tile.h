@@ -0,0 +1,69 @@
+/*
+ * Copyright 2017 Gil Barbosa Reis <gilzoide@gmail.com>
+ * This file is part of libmosaic.
+ * 
+ * Libmosaic is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Libmosaic is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libmosaic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Any bugs should be reported to <gilzoide@gmail.com>
+ */
+
+/** @file tile.h
+ * Sparse tiled storage for very large MOSAICs.
+ *
+ * A tiled MOSAIC keeps its cells in @ref MOS_TILE_SIZE square tiles, which
+ * are allocated only when first written to: untouched tiles all share the
+ * same immutable blank tile. This way, memory grows with the content, not
+ * with the area.
+ *
+ * Tiled MOSAICs work with the get/set/fill/copy functions, @ref mos_trim,
+ * @ref mos_resize, @ref mos_clone and views. They have no row pointers, so
+ * `img->mosaic[y][x]` can't be used, nor @ref mos_submosaic. To save or
+ * load them, copy from/to a regular MOSAIC.
+ */
+
+#ifndef __MOSAIC_TILE_H__
+#define __MOSAIC_TILE_H__
+
+#include "image.h"
+
+/// Width and height of the tiles in a tiled MOSAIC
+#define MOS_TILE_SIZE 64
+
+/**
+ * Create a new tiled @ref MOSAIC, all blank and with no tiles allocated.
+ *
+ * @param[in] height New MOSAIC's height
+ * @param[in] width  New MOSAIC's width
+ *
+ * @return A MOSAIC on success
+ * @return NULL if allocation failed
+ */
+MOSAIC *mos_new_tiled(int height, int width);
+
+/**
+ * Checks whether a MOSAIC uses tiled storage, directly or through its parent.
+ *
+ * @return 1 if tiled
+ * @return 0 otherwise
+ */
+int mos_is_tiled(const MOSAIC *img);
+
+/**
+ * Number of tiles actually allocated in a tiled MOSAIC.
+ *
+ * @return Number of allocated tiles, 0 if img is not tiled
+ */
+int mos_tile_count(const MOSAIC *img);
+
+#endif
@@ -0,0 +1,154 @@
+/*
+ * Copyright 2017 Gil Barbosa Reis <gilzoide@gmail.com>
+ * This file is part of libmosaic.
+ * 
+ * Libmosaic is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Libmosaic is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libmosaic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Any bugs should be reported to <gilzoide@gmail.com>
+ */
+
+#include "mosaic/alloc.h"
+#include "internal.h"
+
+#include <stdlib.h>
+
+static void *std_malloc(size_t size, void *userdata) {
+	(void) userdata;
+	return malloc(size);
+}
+
+static void *std_realloc(void *ptr, size_t size, void *userdata) {
+	(void) userdata;
+	return realloc(ptr, size);
+}
+
+static void std_free(void *ptr, void *userdata) {
+	(void) userdata;
+	free(ptr);
+}
+
+static const mos_allocator std_allocator = {
+	std_malloc, std_realloc, std_free, NULL,
+};
+
+/// The global allocator, used for everything not drawn from an arena
+static mos_allocator global_allocator = {
+	std_malloc, std_realloc, std_free, NULL,
+};
+
+void mos_set_allocator(const mos_allocator *allocator) {
+	global_allocator = allocator ? *allocator : std_allocator;
+}
+
+
+/// Alignment of memory handed out by arenas
+#define ARENA_ALIGN (sizeof(long double) > sizeof(void *) ? sizeof(long double) : sizeof(void *))
+#define ALIGN_UP(n) (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+/// Arena chunk, with the memory right after it
+struct mos_arena_chunk {
+	struct mos_arena_chunk *next;	///< next chunk in the list
+	size_t size;	///< usable bytes in this chunk
+	size_t used;	///< bytes already handed out
+};
+
+/// Size of chunk header, keeping what's after it aligned
+#define CHUNK_HEADER ALIGN_UP(sizeof(struct mos_arena_chunk))
+
+struct mos_arena {
+	struct mos_arena_chunk *chunks;	///< chunk list, the current one first
+	size_t chunk_size;	///< usable size of regular chunks
+};
+
+mos_arena *mos_arena_new(size_t chunk_size) {
+	mos_arena *arena = mos_malloc(NULL, sizeof(mos_arena));
+	if(arena) {
+		arena->chunks = NULL;
+		arena->chunk_size = chunk_size ? chunk_size : MOS_ARENA_DEFAULT_CHUNK;
+	}
+	return arena;
+}
+
+
+void mos_arena_free(mos_arena *arena) {
+	if(arena) {
+		struct mos_arena_chunk *chunk, *next;
+		for(chunk = arena->chunks; chunk; chunk = next) {
+			next = chunk->next;
+			mos_dealloc(NULL, chunk);
+		}
+		mos_dealloc(NULL, arena);
+	}
+}
+
+
+void mos_arena_reset(mos_arena *arena) {
+	struct mos_arena_chunk *chunk;
+	for(chunk = arena->chunks; chunk; chunk = chunk->next) {
+		chunk->used = 0;
+	}
+}
+
+
+/**
+ * Hand out `size` bytes from the arena, from the first chunk that fits
+ * or from a new one.
+ */
+static void *mos_arena_alloc(mos_arena *arena, size_t size) {
+	size = ALIGN_UP(size);
+	struct mos_arena_chunk *chunk;
+	for(chunk = arena->chunks; chunk; chunk = chunk->next) {
+		if(chunk->size - chunk->used >= size) {
+			break;
+		}
+	}
+	if(chunk == NULL) {
+		// oversized allocations get a chunk of their own
+		size_t chunk_size = size > arena->chunk_size ? size : arena->chunk_size;
+		if((chunk = mos_malloc(NULL, CHUNK_HEADER + chunk_size)) == NULL) {
+			return NULL;
+		}
+		chunk->size = chunk_size;
+		chunk->used = 0;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+	}
+	void *ptr = (char *) chunk + CHUNK_HEADER + chunk->used;
+	chunk->used += size;
+	return ptr;
+}
+
+
+void *mos_malloc(mos_arena *arena, size_t size) {
+	return arena
+			? mos_arena_alloc(arena, size)
+			: global_allocator.malloc(size, global_allocator.userdata);
+}
+
+
+void *mos_realloc(void *ptr, size_t size) {
+	return global_allocator.realloc(ptr, size, global_allocator.userdata);
+}
+
+
+void mos_dealloc(mos_arena *arena, void *ptr) {
+	// arena memory is released only in bulk
+	if(arena == NULL && ptr != NULL) {
+		global_allocator.free(ptr, global_allocator.userdata);
+	}
+}
+
+#undef CHUNK_HEADER
+#undef ALIGN_UP
+#undef ARENA_ALIGN
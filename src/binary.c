@@ -0,0 +1,639 @@
+/*
+ * Copyright 2017 Gil Barbosa Reis <gilzoide@gmail.com>
+ * This file is part of libmosaic.
+ * 
+ * Libmosaic is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Libmosaic is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libmosaic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Any bugs should be reported to <gilzoide@gmail.com>
+ */
+
+#include "mosaic/binary.h"
+#include "mosaic/error.h"
+#include "mosaic/tile.h"
+#include "internal.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+/// Magic string that starts .mosb files
+#define MAGIC "MOSB"
+/// Size of the header
+#define HEADER_SIZE 32
+/// Size of the header part covered by its checksum
+#define HEADER_CHECKED 24
+/// Size of each index entry
+#define ENTRY_SIZE 24
+/// Bytes of each plane a block should hold, about
+#define BLOCK_BYTES 65536
+
+/// What the header says
+typedef struct {
+	int version;	///< file version
+	mos_attr_storage_fmt fmt[2];	///< chars and attributes formats
+	int height;	///< image height
+	int width;	///< image width
+	int block_rows;	///< rows per block
+	int count;	///< number of blocks
+} mos_binary_header;
+
+/// An index entry
+typedef struct {
+	uint64_t offset;	///< where the block's data is, from the header's start
+	uint32_t size[2];	///< size of the block's encoded chars and attributes
+	uint64_t checksum;	///< checksum of the block's decoded chars and attributes
+} mos_binary_entry;
+
+static inline int max(int a, int b) {
+	return (a > b ? a : b);
+}
+
+static inline int min(int a, int b) {
+	return (a < b ? a : b);
+}
+
+/// Store n bytes of value at p, little endian
+static void mos_put_le(unsigned char *p, uint64_t value, int n) {
+	int i;
+	for(i = 0; i < n; i++) {
+		p[i] = (value >> (8 * i)) & 0xFF;
+	}
+}
+
+/// Load n bytes at p, little endian
+static uint64_t mos_get_le(const unsigned char *p, int n) {
+	uint64_t value = 0;
+	int i;
+	for(i = 0; i < n; i++) {
+		value |= (uint64_t) p[i] << (8 * i);
+	}
+	return value;
+}
+
+
+/// Serialize header's first HEADER_CHECKED bytes
+static void mos_header_encode(const mos_binary_header *header, unsigned char *bytes) {
+	memcpy(bytes, MAGIC, 4);
+	bytes[4] = header->version;
+	bytes[5] = header->fmt[0];
+	bytes[6] = header->fmt[1];
+	bytes[7] = 0;
+	mos_put_le(bytes + 8, header->height, 4);
+	mos_put_le(bytes + 12, header->width, 4);
+	mos_put_le(bytes + 16, header->block_rows, 4);
+	mos_put_le(bytes + 20, header->count, 4);
+}
+
+/// Serialize an index entry
+static void mos_entry_encode(const mos_binary_entry *entry, unsigned char *bytes) {
+	mos_put_le(bytes, entry->offset, 8);
+	mos_put_le(bytes + 8, entry->size[0], 4);
+	mos_put_le(bytes + 12, entry->size[1], 4);
+	mos_put_le(bytes + 16, entry->checksum, 8);
+}
+
+/// Deserialize an index entry
+static void mos_entry_decode(const unsigned char *bytes, mos_binary_entry *entry) {
+	entry->offset = mos_get_le(bytes, 8);
+	entry->size[0] = mos_get_le(bytes + 8, 4);
+	entry->size[1] = mos_get_le(bytes + 12, 4);
+	entry->checksum = mos_get_le(bytes + 16, 8);
+}
+
+
+/**
+ * Checksum of `height` rows of image from y on, chars then attributes, as
+ * they're decoded: planes stored as @ref MOS_NO_ATTR are all default.
+ */
+static uint64_t mos_block_checksum(const MOSAIC *image, const mos_binary_header *header, int y, int height) {
+	// blank rows are hashed a piece at a time, a multiple of the word size
+	unsigned char blank[256];
+	uint64_t h = 0;
+	int i, k, j;
+	for(k = 0; k < 2; k++) {
+		if(header->fmt[k] == MOS_NO_ATTR) {
+			memset(blank, k ? MOS_DEFAULT_ATTR : MOS_DEFAULT_CHAR, sizeof(blank));
+		}
+		for(i = 0; i < height; i++) {
+			if(header->fmt[k] != MOS_NO_ATTR) {
+				h = k ? mos_checksum(h, mos_attr_row(image, y + i), image->width * sizeof(mos_attr))
+						: mos_checksum(h, mos_char_row(image, y + i), image->width * sizeof(mos_char));
+				continue;
+			}
+			for(j = 0; j < image->width; j += sizeof(blank)) {
+				h = mos_checksum(h, blank, min(sizeof(blank), image->width - j));
+			}
+		}
+	}
+	return h;
+}
+
+
+/**
+ * Encode every block of image to stream, or only count them if stream is
+ * NULL, filling in the index.
+ */
+static int mos_binary_put_blocks(const MOSAIC *image, const mos_binary_header *header
+		, int level, mos_stream *stream, mos_binary_entry *index) {
+	uint64_t offset = HEADER_SIZE + (uint64_t) header->count * ENTRY_SIZE;
+	int b, k, ret;
+	for(b = 0; b < header->count; b++) {
+		const int y = b * header->block_rows;
+		const int height = min(header->block_rows, image->height - y);
+		index[b].offset = offset;
+		for(k = 0; k < 2; k++) {
+			const mos_plane plane = { (MOSAIC *) image, k, y, height, NULL };
+			size_t size;
+			if((ret = mos_plane_encode(&plane, header->fmt[k], level, stream, &size)) != MOS_OK) {
+				return ret;
+			}
+			// blocks are small, but rows may be huge
+			if(size > UINT32_MAX) {
+				return MOS_EUNSUPPORTED;
+			}
+			index[b].size[k] = size;
+			offset += size;
+		}
+		index[b].checksum = mos_block_checksum(image, header, y, height);
+	}
+	return MOS_OK;
+}
+
+
+/**
+ * Write the header and index to stream, with their checksum.
+ */
+static void mos_binary_put_index(const mos_binary_header *header, const mos_binary_entry *index
+		, FILE *stream) {
+	unsigned char bytes[HEADER_SIZE];
+	unsigned char entry[ENTRY_SIZE];
+	int b;
+	mos_header_encode(header, bytes);
+	uint64_t checksum = mos_checksum(0, bytes, HEADER_CHECKED);
+	for(b = 0; b < header->count; b++) {
+		mos_entry_encode(&index[b], entry);
+		checksum = mos_checksum(checksum, entry, ENTRY_SIZE);
+	}
+	mos_put_le(bytes + HEADER_CHECKED, checksum, 8);
+	fwrite(bytes, sizeof(char), HEADER_SIZE, stream);
+	for(b = 0; b < header->count; b++) {
+		mos_entry_encode(&index[b], entry);
+		fwrite(entry, sizeof(char), ENTRY_SIZE, stream);
+	}
+}
+
+
+int mos_binary_fput(const MOSAIC *image, mos_attr_storage_fmt char_fmt
+		, mos_attr_storage_fmt attr_fmt, int level, FILE *stream) {
+	if(mos_is_tiled(image)) {
+		return MOS_EUNSUPPORTED;
+	}
+	if(!mos_is_valid_format(char_fmt) || !mos_is_valid_format(attr_fmt)) {
+		return MOS_EUNKNSTRGFMT;
+	}
+	mos_binary_header header;
+	header.version = MOS_BINARY_VERSION;
+	header.fmt[0] = char_fmt;
+	header.fmt[1] = attr_fmt;
+	header.height = image->height;
+	header.width = image->width;
+	header.block_rows = image->width > 0 && image->width < BLOCK_BYTES ? BLOCK_BYTES / image->width : 1;
+	header.count = image->width > 0 ? (image->height + header.block_rows - 1) / header.block_rows : 0;
+
+	mos_binary_entry *index = mos_malloc(NULL, header.count * sizeof(mos_binary_entry) + 1);
+	if(index == NULL) {
+		return MOS_EMALLOC;
+	}
+	mos_stream blocks = mos_file_stream(stream);
+	int ret;
+	const long start = ftell(stream);
+	const long data_start = HEADER_SIZE + (long) header.count * ENTRY_SIZE;
+	// seekable streams get the blocks first, then the index filled in;
+	// others get them encoded twice, first only to build the index
+	if(start >= 0 && fseek(stream, start + data_start, SEEK_SET) == 0) {
+		if((ret = mos_binary_put_blocks(image, &header, level, &blocks, index)) == MOS_OK) {
+			const long end = ftell(stream);
+			fseek(stream, start, SEEK_SET);
+			mos_binary_put_index(&header, index, stream);
+			fseek(stream, end, SEEK_SET);
+		}
+	}
+	else if((ret = mos_binary_put_blocks(image, &header, level, NULL, index)) == MOS_OK) {
+		mos_binary_put_index(&header, index, stream);
+		ret = mos_binary_put_blocks(image, &header, level, &blocks, index);
+	}
+	mos_dealloc(NULL, index);
+	return ret;
+}
+
+
+/**
+ * Read the header and index from stream, checking them.
+ *
+ * @param[in]  stream The stream to be read from
+ * @param[out] header The header read
+ * @param[out] index  The index read, to be released with @ref mos_dealloc
+ *
+ * @return @ref MOS_OK on success
+ * @return @ref MOS_EMALLOC on allocation errors
+ * @return @ref MOS_ETRUNCATED if the stream ends before the index does
+ * @return @ref MOS_ECORRUPT if it isn't a .mosb header, or checksums don't match
+ * @return @ref MOS_EUNSUPPORTED if the version is newer than this library's
+ */
+static int mos_binary_get_index(FILE *stream, mos_binary_header *header, mos_binary_entry **index) {
+	unsigned char bytes[HEADER_SIZE];
+	unsigned char entry[ENTRY_SIZE];
+	if(fread(bytes, sizeof(char), HEADER_SIZE, stream) != HEADER_SIZE) {
+		return MOS_ETRUNCATED;
+	}
+	if(memcmp(bytes, MAGIC, 4) != 0) {
+		return MOS_ECORRUPT;
+	}
+	header->version = bytes[4];
+	header->fmt[0] = bytes[5];
+	header->fmt[1] = bytes[6];
+	const uint64_t height = mos_get_le(bytes + 8, 4);
+	const uint64_t width = mos_get_le(bytes + 12, 4);
+	const uint64_t block_rows = mos_get_le(bytes + 16, 4);
+	const uint64_t count = mos_get_le(bytes + 20, 4);
+	if(header->version > MOS_BINARY_VERSION) {
+		return MOS_EUNSUPPORTED;
+	}
+	if(height > INT_MAX || width > INT_MAX || block_rows == 0 || block_rows > INT_MAX
+			|| count != (width > 0 ? (height + block_rows - 1) / block_rows : 0)) {
+		return MOS_ECORRUPT;
+	}
+	header->height = height;
+	header->width = width;
+	header->block_rows = block_rows;
+	header->count = count;
+
+	uint64_t checksum = mos_checksum(0, bytes, HEADER_CHECKED);
+	if((*index = mos_malloc(NULL, count * sizeof(mos_binary_entry) + 1)) == NULL) {
+		return MOS_EMALLOC;
+	}
+	int b;
+	for(b = 0; b < header->count; b++) {
+		if(fread(entry, sizeof(char), ENTRY_SIZE, stream) != ENTRY_SIZE) {
+			mos_dealloc(NULL, *index);
+			return MOS_ETRUNCATED;
+		}
+		checksum = mos_checksum(checksum, entry, ENTRY_SIZE);
+		mos_entry_decode(entry, &(*index)[b]);
+	}
+	if(checksum != mos_get_le(bytes + HEADER_CHECKED, 8)) {
+		mos_dealloc(NULL, *index);
+		return MOS_ECORRUPT;
+	}
+	return MOS_OK;
+}
+
+
+int mos_binary_fget(MOSAIC *image, FILE *stream) {
+	if(mos_is_tiled(image)) {
+		return MOS_EUNSUPPORTED;
+	}
+	mos_binary_header header;
+	mos_binary_entry *index;
+	int ret;
+	if((ret = mos_binary_get_index(stream, &header, &index)) != MOS_OK) {
+		return ret;
+	}
+	// whatever was pending is overwritten anyway
+	mos_lazy_free(image);
+	if((ret = mos_resize(image, header.height, header.width)) != MOS_OK
+			|| (ret = mos_unshare(image)) != MOS_OK) {
+		mos_dealloc(NULL, index);
+		return ret;
+	}
+	// everything is (possibly) overwritten
+	mos_mark_dirty(image, 0, 0, image->height, image->width);
+
+	// blocks are read in order, right after the index
+	mos_stream blocks = mos_file_stream(stream);
+	uint64_t offset = HEADER_SIZE + (uint64_t) header.count * ENTRY_SIZE;
+	int b, k;
+	for(b = 0; ret == MOS_OK && b < header.count; b++) {
+		const int y = b * header.block_rows;
+		const int height = min(header.block_rows, image->height - y);
+		if(index[b].offset != offset) {
+			ret = MOS_ECORRUPT;
+			break;
+		}
+		for(k = 0; ret == MOS_OK && k < 2; k++) {
+			const mos_plane plane = { image, k, y, height, NULL };
+			ret = mos_plane_decode(&plane, header.fmt[k], &blocks, index[b].size[k]);
+			offset += index[b].size[k];
+		}
+		if(ret == MOS_OK && mos_block_checksum(image, &header, y, height) != index[b].checksum) {
+			ret = MOS_ECORRUPT;
+		}
+	}
+	mos_dealloc(NULL, index);
+	return ret;
+}
+
+
+/**
+ * Read `height` rows from y on of a block's plane stored raw, only the
+ * columns from x on that fit in image, seeking to each one.
+ */
+static int mos_raw_get_rows(MOSAIC *image, const mos_binary_header *header, int plane
+		, long data, int y, int x, int height, FILE *stream) {
+	const size_t row_size = image->width;
+	int i;
+	for(i = 0; i < height; i++) {
+		unsigned char *row = plane
+				? (unsigned char *) image->attr[y + i]
+				: (unsigned char *) image->mosaic[y + i];
+		if(fseek(stream, data + (long) i * header->width + x, SEEK_SET) != 0) {
+			return MOS_ETRUNCATED;
+		}
+		if(fread(row, sizeof(char), row_size, stream) != row_size) {
+			return MOS_ETRUNCATED;
+		}
+	}
+	return MOS_OK;
+}
+
+
+int mos_binary_fget_region(MOSAIC *image, FILE *stream, int y, int x, int height, int width) {
+	if(mos_is_tiled(image)) {
+		return MOS_EUNSUPPORTED;
+	}
+	const long start = ftell(stream);
+	if(start < 0) {
+		return MOS_EUNSUPPORTED;
+	}
+	mos_binary_header header;
+	mos_binary_entry *index;
+	int ret;
+	if((ret = mos_binary_get_index(stream, &header, &index)) != MOS_OK) {
+		return ret;
+	}
+
+	// the region is clipped to the stored image
+	const int y0 = y > 0 ? y : 0, x0 = x > 0 ? x : 0;
+	const int y1 = min(header.height, y + height), x1 = min(header.width, x + width);
+	MOSAIC *scratch = NULL;
+	mos_lazy_free(image);
+	if((ret = mos_resize(image, y1 > y0 ? y1 - y0 : 0, x1 > x0 ? x1 - x0 : 0)) != MOS_OK
+			|| (ret = mos_unshare(image)) != MOS_OK) {
+		goto END;
+	}
+	mos_mark_dirty(image, 0, 0, image->height, image->width);
+	if(image->height == 0 || image->width == 0) {
+		goto END;
+	}
+
+	// only the blocks with the region's rows are read: raw planes are read
+	// right into the image, the others are decoded into a block sized
+	// scratch image first
+	int b, k;
+	for(b = y0 / header.block_rows; ret == MOS_OK && b * header.block_rows < y1; b++) {
+		const int block_y = b * header.block_rows;
+		const int block_height = min(header.block_rows, header.height - block_y);
+		const int first = y0 > block_y ? y0 : block_y;
+		const int rows = min(y1, block_y + block_height) - first;
+		int partial = 0;
+		long data = start + (long) index[b].offset;
+		for(k = 0; ret == MOS_OK && k < 2; data += index[b].size[k], k++) {
+			if(header.fmt[k] == MOS_UNCOMPRESSED) {
+				if(index[b].size[k] != (uint64_t) block_height * header.width) {
+					ret = MOS_ECORRUPT;
+					break;
+				}
+				ret = mos_raw_get_rows(image, &header, k, data + (long) (first - block_y) * header.width
+						, first - y0, x0, rows, stream);
+				partial = 1;
+				continue;
+			}
+			if(scratch == NULL && (scratch = mos_new(min(header.block_rows, header.height), header.width)) == NULL) {
+				ret = MOS_EMALLOC;
+				break;
+			}
+			const mos_plane plane = { scratch, k, 0, block_height, NULL };
+			if(fseek(stream, data, SEEK_SET) != 0) {
+				ret = MOS_ETRUNCATED;
+				break;
+			}
+			mos_stream block = mos_file_stream(stream);
+			ret = mos_plane_decode(&plane, header.fmt[k], &block, index[b].size[k]);
+		}
+		if(ret != MOS_OK || scratch == NULL) {
+			continue;
+		}
+		// whole blocks can be checked, partly read ones can't
+		if(!partial && mos_block_checksum(scratch, &header, 0, block_height) != index[b].checksum) {
+			ret = MOS_ECORRUPT;
+			break;
+		}
+		for(k = 0; k < 2; k++) {
+			if(header.fmt[k] == MOS_UNCOMPRESSED) {
+				continue;
+			}
+			int i;
+			for(i = 0; i < rows; i++) {
+				const int row = first - block_y + i;
+				if(k) {
+					memcpy(image->attr[first - y0 + i], scratch->attr[row] + x0, image->width * sizeof(mos_attr));
+				}
+				else {
+					memcpy(image->mosaic[first - y0 + i], scratch->mosaic[row] + x0, image->width * sizeof(mos_char));
+				}
+			}
+		}
+	}
+
+END:
+	mos_free(scratch);
+	mos_dealloc(NULL, index);
+	return ret;
+}
+
+
+/// Row blocks of a lazily loaded MOSAIC, and the file they're decoded from
+struct mos_lazy {
+	FILE *stream;	///< the file, kept open until every block is decoded
+	mos_binary_header header;	///< the file's header
+	mos_binary_entry *index;	///< the file's index
+	int pending;	///< number of blocks not yet decoded
+	unsigned char decoded[];	///< boolean per block: has it been decoded?
+};
+
+
+void mos_lazy_free(MOSAIC *img) {
+	struct mos_lazy *lazy = img->lazy;
+	if(lazy) {
+		fclose(lazy->stream);
+		mos_dealloc(NULL, lazy->index);
+		mos_dealloc(NULL, lazy);
+		img->lazy = NULL;
+	}
+}
+
+
+/**
+ * Decode block b of a lazily loaded img into its rows, or blank them if
+ * that fails, so that they're never left half decoded.
+ */
+static int mos_lazy_decode(MOSAIC *img, int b) {
+	struct mos_lazy *lazy = img->lazy;
+	const mos_binary_header *header = &lazy->header;
+	const mos_binary_entry *entry = &lazy->index[b];
+	const int y = b * header->block_rows;
+	const int height = min(header->block_rows, img->height - y);
+	mos_stream block = mos_file_stream(lazy->stream);
+	int k, i, ret = MOS_OK;
+	if(fseek(lazy->stream, (long) entry->offset, SEEK_SET) != 0) {
+		ret = MOS_ETRUNCATED;
+	}
+	for(k = 0; ret == MOS_OK && k < 2; k++) {
+		const mos_plane plane = { img, k, y, height, NULL };
+		ret = mos_plane_decode(&plane, header->fmt[k], &block, entry->size[k]);
+	}
+	if(ret == MOS_OK && mos_block_checksum(img, header, y, height) != entry->checksum) {
+		ret = MOS_ECORRUPT;
+	}
+	if(ret != MOS_OK) {
+		for(i = 0; i < height; i++) {
+			memset(img->mosaic[y + i], MOS_DEFAULT_CHAR, img->width * sizeof(mos_char));
+			memset(img->attr[y + i], MOS_DEFAULT_ATTR, img->width * sizeof(mos_attr));
+		}
+	}
+	return ret;
+}
+
+
+int mos_lazy_touch(MOSAIC *img, int y, int height) {
+	struct mos_lazy *lazy = img->lazy;
+	const int y0 = max(y, 0), y1 = min(img->height, y + height);
+	int b, ret = MOS_OK, decoded = 0;
+	for(b = y0 / lazy->header.block_rows; y0 < y1 && b * lazy->header.block_rows < y1; b++) {
+		if(lazy->decoded[b]) {
+			continue;
+		}
+		// marked first, as decoding goes through the block's rows itself
+		lazy->decoded[b] = 1;
+		lazy->pending--;
+		decoded = 1;
+		const int block_ret = mos_lazy_decode(img, b);
+		if(ret == MOS_OK) {
+			ret = block_ret;
+		}
+	}
+	// nested calls never decode a thing, so only the outermost one gets here
+	if(decoded && lazy->pending == 0) {
+		mos_lazy_free(img);
+	}
+	return ret;
+}
+
+
+int mos_touch_rows(MOSAIC *image, int y, int height) {
+	// subMOSAICs and views touch only their own rows
+	const int y0 = max(y, 0), y1 = min(image->height, y + height);
+	if(image->parent) {
+		return mos_touch_rows(image->parent, image->begin_y + y0, y1 - y0);
+	}
+	return image->lazy ? mos_lazy_touch(image, y0, y1 - y0) : MOS_OK;
+}
+
+
+int mos_binary_load_lazy(MOSAIC *image, const char *file_name) {
+	if(mos_is_tiled(image) || image->arena) {
+		return MOS_EUNSUPPORTED;
+	}
+	FILE *f;
+	if((f = fopen(file_name, "rb")) == NULL) {
+		return errno;
+	}
+	mos_binary_header header;
+	mos_binary_entry *index;
+	int ret;
+	if((ret = mos_binary_get_index(f, &header, &index)) != MOS_OK) {
+		fclose(f);
+		return ret;
+	}
+	// blocks are read only later on, but at least they must all be there
+	long end;
+	int b;
+	if(fseek(f, 0, SEEK_END) != 0 || (end = ftell(f)) < 0) {
+		ret = MOS_EUNSUPPORTED;
+	}
+	for(b = 0; ret == MOS_OK && b < header.count; b++) {
+		if(index[b].offset + index[b].size[0] + index[b].size[1] > (uint64_t) end) {
+			ret = MOS_ETRUNCATED;
+		}
+	}
+	struct mos_lazy *lazy = NULL;
+	if(ret == MOS_OK && header.count > 0
+			&& (lazy = mos_malloc(NULL, sizeof(struct mos_lazy) + header.count)) == NULL) {
+		ret = MOS_EMALLOC;
+	}
+	if(ret == MOS_OK) {
+		// whatever was pending is replaced
+		mos_lazy_free(image);
+	}
+	if(ret != MOS_OK
+			|| (ret = mos_unshare(image)) != MOS_OK
+			|| (ret = mos_resize_uninit(image, header.height, header.width)) != MOS_OK
+			|| lazy == NULL) {
+		mos_dealloc(NULL, lazy);
+		mos_dealloc(NULL, index);
+		fclose(f);
+		return ret;
+	}
+	// pending rows are uninitialized, but they're decoded before anything
+	// reads them, and everything is overwritten sooner or later
+	mos_mark_dirty(image, 0, 0, image->height, image->width);
+
+	lazy->stream = f;
+	lazy->header = header;
+	lazy->index = index;
+	lazy->pending = header.count;
+	memset(lazy->decoded, 0, header.count);
+	image->lazy = lazy;
+	return MOS_OK;
+}
+
+
+int mos_binary_load(MOSAIC *image, const char *file_name) {
+	FILE *f;
+	if((f = fopen(file_name, "rb")) == NULL) {
+		return errno;
+	}
+	int ret = mos_binary_fget(image, f);
+	fclose(f);
+	return ret;
+}
+
+
+int mos_binary_save(MOSAIC *image, mos_attr_storage_fmt char_fmt
+		, mos_attr_storage_fmt attr_fmt, int level, const char *file_name) {
+	FILE *f;
+	if((f = fopen(file_name, "wb")) == NULL) {
+		return errno;
+	}
+	int ret = mos_binary_fput(image, char_fmt, attr_fmt, level, f);
+	fclose(f);
+	return ret;
+}
+
+#undef BLOCK_BYTES
+#undef ENTRY_SIZE
+#undef HEADER_CHECKED
+#undef HEADER_SIZE
+#undef MAGIC
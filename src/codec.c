@@ -0,0 +1,871 @@
+/*
+ * Copyright 2017 Gil Barbosa Reis <gilzoide@gmail.com>
+ * This file is part of libmosaic.
+ * 
+ * Libmosaic is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Libmosaic is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libmosaic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Any bugs should be reported to <gilzoide@gmail.com>
+ */
+
+#include "mosaic/error.h"
+#include "internal.h"
+
+#ifdef ENABLE_ZLIB
+# include <zlib.h>
+#endif
+
+#ifdef ENABLE_ZSTD
+# include <zstd.h>
+#endif
+
+#ifdef ENABLE_LZ4
+# include <lz4frame.h>
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+/// Size of the buffers encoded planes stream through
+#define CODEC_CHUNK 16384
+/// Bytes decoded past the plane are caught in buffers this big
+#define EXCESS_SIZE 64
+
+/// Size of plane's row, in bytes
+static inline size_t mos_plane_row_size(const mos_plane *plane) {
+	return plane->plane
+			? plane->image->width * sizeof(mos_attr)
+			: plane->image->width * sizeof(mos_char);
+}
+
+/**
+ * Next row of a spooled plane, read into its image's first row, which is
+ * valid until the next one is read.
+ */
+static unsigned char *mos_plane_spooled_row(const mos_plane *plane) {
+	unsigned char *row = plane->plane
+			? (unsigned char *) plane->image->attr[0]
+			: (unsigned char *) plane->image->mosaic[0];
+	const size_t size = mos_plane_row_size(plane);
+	const size_t n = fread(row, sizeof(char), size, plane->spool);
+	// short reads leave the spool's error or EOF flag set, for
+	// mos_plane_encode to report; the row is just blanked meanwhile
+	if(n < size) {
+		memset(row + n, 0, size - n);
+	}
+	return row;
+}
+
+/// Row i of plane, as bytes; spooled planes' rows must be asked for in order
+static inline unsigned char *mos_plane_row(const mos_plane *plane, int i) {
+	if(plane->spool) {
+		return mos_plane_spooled_row(plane);
+	}
+	return plane->plane
+			? (unsigned char *) mos_attr_row(plane->image, plane->y + i)
+			: (unsigned char *) mos_char_row(plane->image, plane->y + i);
+}
+
+/**
+ * Encode plane, writing the encoded data to stream if it's not NULL, and
+ * storing its size.
+ *
+ * @return MOS_OK on success
+ * @return MOS_EMALLOC on allocation errors
+ * @return MOS_ECOMPRESSION for compression errors
+ */
+typedef int (*mos_plane_encoder)(const mos_plane *plane, int level, mos_stream *stream, size_t *size);
+
+/**
+ * Decode `size` bytes of encoded data from stream into plane, consuming
+ * them all.
+ *
+ * @return MOS_OK on success
+ * @return MOS_EMALLOC on allocation errors
+ * @return MOS_ETRUNCATED if the data ends before the encoded stream
+ * @return MOS_ECORRUPT if the data doesn't decode to exactly the plane
+ * @return MOS_ECOMPRESSION for other decompression errors
+ */
+typedef int (*mos_plane_decoder)(const mos_plane *plane, mos_stream *stream, size_t size);
+
+/// A storage format, NULL functions if not supported
+typedef struct {
+	mos_plane_encoder encode;
+	mos_plane_decoder decode;
+} mos_plane_codec;
+
+
+/**
+ * Raw rows, see @ref mos_plane_encoder.
+ */
+static int mos_raw_encode(const mos_plane *plane, int level, mos_stream *stream, size_t *size) {
+	(void) level;
+	const size_t row_size = mos_plane_row_size(plane);
+	int i;
+	for(i = 0; stream && i < plane->height; i++) {
+		mos_stream_write(stream, mos_plane_row(plane, i), row_size);
+	}
+	*size = plane->height * row_size;
+	return MOS_OK;
+}
+
+
+/**
+ * Raw rows, read straight into the plane, see @ref mos_plane_decoder.
+ */
+static int mos_raw_decode(const mos_plane *plane, mos_stream *stream, size_t size) {
+	const size_t row_size = mos_plane_row_size(plane);
+	if(size != MOS_UNKNOWN_SIZE && size != plane->height * row_size) {
+		return MOS_ECORRUPT;
+	}
+	int i;
+	for(i = 0; i < plane->height; i++) {
+		if(mos_stream_read(stream, mos_plane_row(plane, i), row_size) != row_size) {
+			return MOS_ETRUNCATED;
+		}
+	}
+	return MOS_OK;
+}
+
+
+/**
+ * Nothing at all, see @ref mos_plane_encoder.
+ */
+static int mos_blank_encode(const mos_plane *plane, int level, mos_stream *stream, size_t *size) {
+	(void) plane;
+	(void) level;
+	(void) stream;
+	*size = 0;
+	return MOS_OK;
+}
+
+
+/**
+ * Nothing at all, so the plane is all default, see @ref mos_plane_decoder.
+ */
+static int mos_blank_decode(const mos_plane *plane, mos_stream *stream, size_t size) {
+	(void) stream;
+	if(size != MOS_UNKNOWN_SIZE && size != 0) {
+		return MOS_ECORRUPT;
+	}
+	const int value = plane->plane ? MOS_DEFAULT_ATTR : MOS_DEFAULT_CHAR;
+	const size_t row_size = mos_plane_row_size(plane);
+	int i;
+	for(i = 0; i < plane->height; i++) {
+		memset(mos_plane_row(plane, i), value, row_size);
+	}
+	return MOS_OK;
+}
+
+
+/// Header bit of run packets, literals have it unset
+#define RLE_RUN 0x80
+/// Longest length stored in the header itself, the value for longer ones
+#define RLE_SHORT 127
+/// Shortest run worth ending a literal for
+#define RLE_MIN_RUN 3
+
+/**
+ * Write a @ref MOS_RLE packet header, if stream is not NULL: length and,
+ * if needed, its LEB128 extension.
+ *
+ * @return The header size
+ */
+static size_t mos_rle_put_header(mos_stream *stream, int run, size_t length) {
+	const int flag = run ? RLE_RUN : 0;
+	if(length <= RLE_SHORT) {
+		if(stream) {
+			mos_stream_putc(stream, flag | (int) (length - 1));
+		}
+		return 1;
+	}
+	size_t size = 2;
+	if(stream) {
+		mos_stream_putc(stream, flag | RLE_SHORT);
+	}
+	for(length -= RLE_SHORT + 1; length >= 0x80; length >>= 7, size++) {
+		if(stream) {
+			mos_stream_putc(stream, (int) (length & 0x7F) | 0x80);
+		}
+	}
+	if(stream) {
+		mos_stream_putc(stream, (int) length);
+	}
+	return size;
+}
+
+
+/**
+ * Count how many bytes from p on are equal to it, comparing 8 at a time
+ * while possible.
+ */
+static size_t mos_rle_run_length(const unsigned char *p, const unsigned char *end) {
+	const uint64_t pattern = UINT64_C(0x0101010101010101) * *p;
+	const unsigned char *q = p + 1;
+	uint64_t word;
+	for( ; end - q >= (ptrdiff_t) sizeof(word); q += sizeof(word)) {
+		memcpy(&word, q, sizeof(word));
+		if(word != pattern) {
+			break;
+		}
+	}
+	for( ; q < end && *q == *p; q++);
+	return q - p;
+}
+
+
+/**
+ * Run-length encode plane, see @ref MOS_RLE and @ref mos_plane_encoder.
+ *
+ * Runs go on from one row to the next, literals are written straight from
+ * the rows, so nothing is buffered but the run being counted.
+ */
+static int mos_rle_encode(const mos_plane *plane, int level, mos_stream *stream, size_t *size) {
+	(void) level;
+	const size_t row_size = mos_plane_row_size(plane);
+	// the run being counted, written only when something else shows up
+	unsigned char value = 0;
+	size_t pending = 0;
+	int i;
+	*size = 0;
+	for(i = 0; i < plane->height; i++) {
+		const unsigned char *p = mos_plane_row(plane, i), *end = p + row_size;
+		size_t n = p < end ? mos_rle_run_length(p, end) : 0;
+		while(p < end) {
+			if(pending > 0 && *p == value) {
+				pending += n;
+			}
+			else {
+				if(pending > 0) {
+					*size += mos_rle_put_header(stream, 1, pending) + 1;
+					if(stream) {
+						mos_stream_putc(stream, value);
+					}
+					pending = 0;
+				}
+				if(n >= RLE_MIN_RUN) {
+					value = *p;
+					pending = n;
+				}
+				else {
+					// literal up to the next run worth it, which is already counted
+					const unsigned char *literal = p;
+					do {
+						p += n;
+					} while(p < end && (n = mos_rle_run_length(p, end)) < RLE_MIN_RUN);
+					*size += mos_rle_put_header(stream, 0, p - literal) + (p - literal);
+					if(stream) {
+						mos_stream_write(stream, literal, p - literal);
+					}
+					continue;
+				}
+			}
+			p += n;
+			if(p < end) {
+				n = mos_rle_run_length(p, end);
+			}
+		}
+	}
+	if(pending > 0) {
+		*size += mos_rle_put_header(stream, 1, pending) + 1;
+		if(stream) {
+			mos_stream_putc(stream, value);
+		}
+	}
+	return MOS_OK;
+}
+
+
+/**
+ * Decode run-length encoded data from stream into plane, see
+ * @ref MOS_RLE and @ref mos_plane_decoder.
+ *
+ * Packets are read until the plane is filled, and nothing more: runs are
+ * `memset` and literals `fread` straight into the rows.
+ */
+static int mos_rle_decode(const mos_plane *plane, mos_stream *stream, size_t size) {
+	const size_t row_size = mos_plane_row_size(plane);
+	size_t remaining = plane->height * row_size, consumed = 0, j = 0;
+	int i = 0;
+	while(remaining > 0) {
+		int c = mos_stream_getc(stream);
+		if(c == EOF) {
+			return MOS_ETRUNCATED;
+		}
+		consumed++;
+		const int run = c & RLE_RUN;
+		size_t length = (c & ~RLE_RUN) + 1;
+		if(length > RLE_SHORT) {
+			size_t extra = 0;
+			int shift = 0;
+			do {
+				if((c = mos_stream_getc(stream)) == EOF) {
+					return MOS_ETRUNCATED;
+				}
+				consumed++;
+				if(shift >= (int) (8 * sizeof(size_t)) || (size_t) (c & 0x7F) > remaining >> shift) {
+					return MOS_ECORRUPT;
+				}
+				extra |= (size_t) (c & 0x7F) << shift;
+				shift += 7;
+			} while(c & 0x80);
+			length += extra;
+		}
+		if(length > remaining) {
+			return MOS_ECORRUPT;
+		}
+		remaining -= length;
+		if(run) {
+			if((c = mos_stream_getc(stream)) == EOF) {
+				return MOS_ETRUNCATED;
+			}
+			consumed++;
+		}
+		else {
+			consumed += length;
+		}
+
+		// packets go on from one row to the next
+		while(length > 0) {
+			const size_t n = row_size - j < length ? row_size - j : length;
+			unsigned char *cells = mos_plane_row(plane, i) + j;
+			if(run) {
+				memset(cells, c, n);
+			}
+			else if(mos_stream_read(stream, cells, n) != n) {
+				return MOS_ETRUNCATED;
+			}
+			length -= n;
+			if((j += n) == row_size) {
+				i++;
+				j = 0;
+			}
+		}
+	}
+	return size == MOS_UNKNOWN_SIZE || consumed == size ? MOS_OK : MOS_ECORRUPT;
+}
+
+#undef RLE_MIN_RUN
+#undef RLE_SHORT
+#undef RLE_RUN
+
+
+#if defined(ENABLE_ZLIB) || defined(ENABLE_ZSTD) || defined(ENABLE_LZ4)
+/**
+ * Get the next chunk of encoded data, never past the `remaining` bytes of
+ * its recorded size: FILE streams read it into buffer, a CODEC_CHUNK at a
+ * time, memory streams hand it out right where it is.
+ *
+ * @return The chunk, with its size stored in `n`, 0 meaning the data was
+ *         cut short
+ */
+static const unsigned char *mos_read_chunk(mos_stream *stream, unsigned char *buffer, size_t *remaining, size_t *n) {
+	if(stream->file) {
+		*n = fread(buffer, sizeof(char), *remaining < CODEC_CHUNK ? *remaining : CODEC_CHUNK, stream->file);
+		*remaining -= *n;
+		return buffer;
+	}
+	const unsigned char *chunk = stream->data + stream->pos;
+	const size_t left = stream->pos < stream->length ? stream->length - stream->pos : 0;
+	// decoders take int sized chunks at most
+	*n = *remaining < left ? *remaining : left;
+	if(*n > INT_MAX) {
+		*n = INT_MAX;
+	}
+	stream->pos += *n;
+	*remaining -= *n;
+	return chunk;
+}
+
+
+/**
+ * Where decoding goes next: row `*i` of plane, or the excess buffer if
+ * they're all filled, so that too much data is noticed.
+ *
+ * @return The output pointer, with its size stored in `size`
+ */
+static unsigned char *mos_next_output(const mos_plane *plane, int *i, unsigned char *excess, size_t *size) {
+	if(*i < plane->height && (*size = mos_plane_row_size(plane)) > 0) {
+		return mos_plane_row(plane, (*i)++);
+	}
+	*size = EXCESS_SIZE;
+	return excess;
+}
+
+
+/**
+ * Check what's left after a compressed stream ended: data should have
+ * decoded to exactly the plane, with nothing left of the recorded size.
+ */
+static int mos_check_end(const mos_plane *plane, size_t total, size_t unused) {
+	return total == plane->height * mos_plane_row_size(plane) && unused == 0
+			? MOS_OK
+			: MOS_ECORRUPT;
+}
+#endif
+
+
+#ifdef ENABLE_ZLIB
+/// zlib level for a @ref mos_fput_level level
+static int mos_zlib_level(int level) {
+	return level == MOS_DEFAULT_LEVEL ? Z_DEFAULT_COMPRESSION
+			: level < 1 ? 1
+			: level > 9 ? 9
+			: level;
+}
+
+
+/**
+ * Deflate plane a row at a time through a fixed buffer, see
+ * @ref mos_plane_encoder.
+ */
+static int mos_deflate_plane(const mos_plane *plane, int level, mos_stream *stream, size_t *size) {
+	z_stream strm;
+	strm.zalloc = Z_NULL;
+	strm.zfree = Z_NULL;
+	strm.opaque = Z_NULL;
+	if(deflateInit(&strm, mos_zlib_level(level)) != Z_OK) {
+		return MOS_ECOMPRESSION;
+	}
+
+	Bytef out[CODEC_CHUNK];
+	*size = 0;
+	int i;
+	// one more pass with no input, to finish the stream
+	for(i = 0; i <= plane->height; i++) {
+		int flush = Z_NO_FLUSH;
+		if(i < plane->height) {
+			strm.next_in = mos_plane_row(plane, i);
+			strm.avail_in = mos_plane_row_size(plane);
+		}
+		else {
+			strm.next_in = Z_NULL;
+			strm.avail_in = 0;
+			flush = Z_FINISH;
+		}
+
+		do {
+			strm.next_out = out;
+			strm.avail_out = CODEC_CHUNK;
+			if(deflate(&strm, flush) == Z_STREAM_ERROR) {
+				deflateEnd(&strm);
+				return MOS_ECOMPRESSION;
+			}
+			const size_t have = CODEC_CHUNK - strm.avail_out;
+			if(stream) {
+				mos_stream_write(stream, out, have);
+			}
+			*size += have;
+		} while(strm.avail_out == 0);
+	}
+	deflateEnd(&strm);
+	return MOS_OK;
+}
+
+
+/**
+ * Inflate zlib data read through a fixed buffer, never past its recorded
+ * size, straight into the plane's rows, see @ref mos_plane_decoder.
+ */
+static int mos_inflate_plane(const mos_plane *plane, mos_stream *stream, size_t remaining) {
+	z_stream strm;
+	strm.zalloc = Z_NULL;
+	strm.zfree = Z_NULL;
+	strm.opaque = Z_NULL;
+	strm.avail_in = 0;
+	strm.next_in = Z_NULL;
+	if(inflateInit(&strm) != Z_OK) {
+		return MOS_ECOMPRESSION;
+	}
+
+	unsigned char in[CODEC_CHUNK];
+	unsigned char excess[EXCESS_SIZE];
+	size_t out_size;
+	int i = 0, ret = MOS_OK, zret;
+	strm.avail_out = 0;
+	do {
+		if(strm.avail_in == 0) {
+			size_t in_size;
+			strm.next_in = (Bytef *) mos_read_chunk(stream, in, &remaining, &in_size);
+			if((strm.avail_in = in_size) == 0) {
+				ret = MOS_ETRUNCATED;
+				break;
+			}
+		}
+		if(strm.avail_out == 0) {
+			strm.next_out = mos_next_output(plane, &i, excess, &out_size);
+			strm.avail_out = out_size;
+		}
+		zret = inflate(&strm, Z_NO_FLUSH);
+		if(zret == Z_MEM_ERROR) {
+			ret = MOS_EMALLOC;
+		}
+		else if(zret == Z_DATA_ERROR || zret == Z_NEED_DICT) {
+			ret = MOS_ECORRUPT;
+		}
+		else if(zret == Z_STREAM_ERROR) {
+			ret = MOS_ECOMPRESSION;
+		}
+	} while(ret == MOS_OK && zret != Z_STREAM_END);
+
+	if(ret == MOS_OK) {
+		ret = mos_check_end(plane, strm.total_out, strm.avail_in + remaining);
+	}
+	inflateEnd(&strm);
+	return ret;
+}
+#endif
+
+
+#ifdef ENABLE_ZSTD
+/**
+ * Compress plane with zstd a row at a time through a fixed buffer, see
+ * @ref mos_plane_encoder.
+ */
+static int mos_zstd_encode(const mos_plane *plane, int level, mos_stream *stream, size_t *size) {
+	ZSTD_CCtx *cctx = ZSTD_createCCtx();
+	if(cctx == NULL) {
+		return MOS_EMALLOC;
+	}
+	// zstd's own default level is 0 too
+	if(ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level))) {
+		ZSTD_freeCCtx(cctx);
+		return MOS_ECOMPRESSION;
+	}
+
+	char buffer[CODEC_CHUNK];
+	*size = 0;
+	int i;
+	// one more pass with no input, to end the frame
+	for(i = 0; i <= plane->height; i++) {
+		ZSTD_inBuffer in = { NULL, 0, 0 };
+		ZSTD_EndDirective mode = ZSTD_e_end;
+		if(i < plane->height) {
+			in.src = mos_plane_row(plane, i);
+			in.size = mos_plane_row_size(plane);
+			mode = ZSTD_e_continue;
+		}
+
+		size_t left;
+		do {
+			ZSTD_outBuffer out = { buffer, CODEC_CHUNK, 0 };
+			left = ZSTD_compressStream2(cctx, &out, &in, mode);
+			if(ZSTD_isError(left)) {
+				ZSTD_freeCCtx(cctx);
+				return MOS_ECOMPRESSION;
+			}
+			if(stream) {
+				mos_stream_write(stream, buffer, out.pos);
+			}
+			*size += out.pos;
+		} while(mode == ZSTD_e_end ? left > 0 : in.pos < in.size);
+	}
+	ZSTD_freeCCtx(cctx);
+	return MOS_OK;
+}
+
+
+/**
+ * Decompress zstd data read through a fixed buffer, never past its
+ * recorded size, straight into the plane's rows, see
+ * @ref mos_plane_decoder.
+ */
+static int mos_zstd_decode(const mos_plane *plane, mos_stream *stream, size_t remaining) {
+	ZSTD_DCtx *dctx = ZSTD_createDCtx();
+	if(dctx == NULL) {
+		return MOS_EMALLOC;
+	}
+
+	unsigned char buffer[CODEC_CHUNK];
+	unsigned char excess[EXCESS_SIZE];
+	ZSTD_inBuffer in = { buffer, 0, 0 };
+	ZSTD_outBuffer out = { NULL, 0, 0 };
+	size_t total = 0, left;
+	int i = 0, ret = MOS_OK, progress = 0;
+	do {
+		// data consumed may still be buffered in dctx, so only ask for
+		// more input once a call couldn't move anything
+		if(in.pos == in.size && !progress) {
+			in.src = mos_read_chunk(stream, buffer, &remaining, &in.size);
+			if(in.size == 0) {
+				ret = MOS_ETRUNCATED;
+				break;
+			}
+			in.pos = 0;
+		}
+		if(out.pos == out.size) {
+			total += out.pos;
+			out.dst = mos_next_output(plane, &i, excess, &out.size);
+			out.pos = 0;
+		}
+		const size_t in_pos = in.pos, out_pos = out.pos;
+		left = ZSTD_decompressStream(dctx, &out, &in);
+		if(ZSTD_isError(left)) {
+			ret = MOS_ECORRUPT;
+		}
+		progress = in.pos > in_pos || out.pos > out_pos;
+	} while(ret == MOS_OK && left > 0);
+
+	if(ret == MOS_OK) {
+		ret = mos_check_end(plane, total + out.pos, in.size - in.pos + remaining);
+	}
+	ZSTD_freeDCtx(dctx);
+	return ret;
+}
+#endif
+
+
+#ifdef ENABLE_LZ4
+/**
+ * Compress plane in a lz4 frame, a chunk at a time through a fixed
+ * buffer, see @ref mos_plane_encoder.
+ */
+static int mos_lz4_encode(const mos_plane *plane, int level, mos_stream *stream, size_t *size) {
+	LZ4F_preferences_t preferences;
+	memset(&preferences, 0, sizeof(preferences));
+	// lz4's own default level is 0 too
+	preferences.compressionLevel = level;
+	// room for a chunk of input, plus what's buffered before it
+	const size_t capacity = LZ4F_compressBound(CODEC_CHUNK, &preferences);
+
+	LZ4F_cctx *cctx;
+	if(LZ4F_isError(LZ4F_createCompressionContext(&cctx, LZ4F_VERSION))) {
+		return MOS_EMALLOC;
+	}
+	char *buffer = mos_malloc(NULL, capacity);
+	if(buffer == NULL) {
+		LZ4F_freeCompressionContext(cctx);
+		return MOS_EMALLOC;
+	}
+
+	const unsigned char *row = NULL;
+	size_t left = 0;
+	int i = 0, ended = 0;
+	*size = 0;
+	size_t have = LZ4F_compressBegin(cctx, buffer, capacity, &preferences);
+	while(!LZ4F_isError(have)) {
+		if(stream) {
+			mos_stream_write(stream, buffer, have);
+		}
+		*size += have;
+		// next piece of input: what's left of the row, at most a chunk
+		while(left == 0 && i < plane->height) {
+			row = mos_plane_row(plane, i++);
+			left = mos_plane_row_size(plane);
+		}
+		if(left > 0) {
+			const size_t n = left < CODEC_CHUNK ? left : CODEC_CHUNK;
+			have = LZ4F_compressUpdate(cctx, buffer, capacity, row, n, NULL);
+			row += n;
+			left -= n;
+		}
+		else if(!ended) {
+			have = LZ4F_compressEnd(cctx, buffer, capacity, NULL);
+			ended = 1;
+		}
+		else {
+			break;
+		}
+	}
+	mos_dealloc(NULL, buffer);
+	LZ4F_freeCompressionContext(cctx);
+	return LZ4F_isError(have) ? MOS_ECOMPRESSION : MOS_OK;
+}
+
+
+/**
+ * Decompress a lz4 frame read through a fixed buffer, never past its
+ * recorded size, straight into the plane's rows, see
+ * @ref mos_plane_decoder.
+ */
+static int mos_lz4_decode(const mos_plane *plane, mos_stream *stream, size_t remaining) {
+	LZ4F_dctx *dctx;
+	if(LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION))) {
+		return MOS_EMALLOC;
+	}
+
+	unsigned char buffer[CODEC_CHUNK];
+	unsigned char excess[EXCESS_SIZE];
+	const unsigned char *in = buffer;
+	size_t in_size = 0, out_size = 0, total = 0, hint;
+	unsigned char *out = NULL;
+	int i = 0, ret = MOS_OK;
+	do {
+		if(in_size == 0) {
+			in = mos_read_chunk(stream, buffer, &remaining, &in_size);
+			if(in_size == 0) {
+				ret = MOS_ETRUNCATED;
+				break;
+			}
+		}
+		if(out_size == 0) {
+			out = mos_next_output(plane, &i, excess, &out_size);
+		}
+		size_t consumed = in_size, produced = out_size;
+		hint = LZ4F_decompress(dctx, out, &produced, in, &consumed, NULL);
+		if(LZ4F_isError(hint)) {
+			ret = MOS_ECORRUPT;
+		}
+		in += consumed;
+		in_size -= consumed;
+		out += produced;
+		out_size -= produced;
+		total += produced;
+	} while(ret == MOS_OK && hint > 0);
+
+	if(ret == MOS_OK) {
+		ret = mos_check_end(plane, total, in_size + remaining);
+	}
+	LZ4F_freeDecompressionContext(dctx);
+	return ret;
+}
+#endif
+
+
+/**
+ * Codec of a storage format.
+ *
+ * @return The codec, with NULL functions if it's not supported
+ * @return NULL if fmt is unknown
+ */
+static const mos_plane_codec *mos_find_codec(mos_attr_storage_fmt fmt) {
+	static const mos_plane_codec raw_codec = { mos_raw_encode, mos_raw_decode };
+	static const mos_plane_codec blank_codec = { mos_blank_encode, mos_blank_decode };
+	static const mos_plane_codec rle_codec = { mos_rle_encode, mos_rle_decode };
+	static const mos_plane_codec zlib_codec = {
+#ifdef ENABLE_ZLIB
+		mos_deflate_plane, mos_inflate_plane,
+#else
+		NULL, NULL,
+#endif
+	};
+	static const mos_plane_codec zstd_codec = {
+#ifdef ENABLE_ZSTD
+		mos_zstd_encode, mos_zstd_decode,
+#else
+		NULL, NULL,
+#endif
+	};
+	static const mos_plane_codec lz4_codec = {
+#ifdef ENABLE_LZ4
+		mos_lz4_encode, mos_lz4_decode,
+#else
+		NULL, NULL,
+#endif
+	};
+	switch(fmt) {
+		case MOS_UNCOMPRESSED:
+			return &raw_codec;
+
+		case MOS_NO_ATTR:
+			return &blank_codec;
+
+		case MOS_RLE:
+			return &rle_codec;
+
+		case MOS_COMPRESSED:
+			return &zlib_codec;
+
+		case MOS_ZSTD:
+			return &zstd_codec;
+
+		case MOS_LZ4:
+			return &lz4_codec;
+
+		default:
+			return NULL;
+	}
+}
+
+
+int mos_plane_encode(const mos_plane *plane, mos_attr_storage_fmt fmt, int level, mos_stream *stream, size_t *size) {
+	const mos_plane_codec *codec = mos_find_codec(fmt);
+	if(codec == NULL) {
+		return MOS_EUNKNSTRGFMT;
+	}
+	// spooled rows are read from the start every time, as planes may be
+	// encoded twice
+	if(plane->spool) {
+		rewind(plane->spool);
+	}
+	int ret = codec->encode ? codec->encode(plane, level, stream, size) : MOS_EUNSUPPORTED;
+	if(ret == MOS_OK && plane->spool) {
+		if(ferror(plane->spool)) {
+			ret = EIO;
+		}
+		else if(feof(plane->spool)) {
+			ret = MOS_ETRUNCATED;
+		}
+	}
+	return ret;
+}
+
+
+int mos_plane_decode(const mos_plane *plane, mos_attr_storage_fmt fmt, mos_stream *stream, size_t size) {
+	const mos_plane_codec *codec = mos_find_codec(fmt);
+	if(codec == NULL) {
+		return MOS_EUNKNSTRGFMT;
+	}
+	return codec->decode ? codec->decode(plane, stream, size) : MOS_EUNSUPPORTED;
+}
+
+
+int mos_plane_write_sized(const mos_plane *plane, mos_attr_storage_fmt fmt, int level, mos_stream *stream) {
+	const mos_plane_codec *codec = mos_find_codec(fmt);
+	if(codec == NULL) {
+		return MOS_EUNKNSTRGFMT;
+	}
+	if(codec->encode == NULL) {
+		return MOS_EUNSUPPORTED;
+	}
+	size_t encoded_size = 0;
+	int ret;
+	const long start = mos_stream_tell(stream);
+	// seekable streams get the data first, then its size filled in;
+	// others get it encoded twice, first only to count it
+	if(start >= 0 && mos_stream_seek(stream, sizeof(size_t), SEEK_CUR) == 0) {
+		if((ret = mos_plane_encode(plane, fmt, level, stream, &encoded_size)) != MOS_OK) {
+			return ret;
+		}
+		mos_stream_seek(stream, start, SEEK_SET);
+		mos_stream_write(stream, &encoded_size, sizeof(size_t));
+		mos_stream_seek(stream, encoded_size, SEEK_CUR);
+		return MOS_OK;
+	}
+	if((ret = mos_plane_encode(plane, fmt, level, NULL, &encoded_size)) != MOS_OK) {
+		return ret;
+	}
+	mos_stream_write(stream, &encoded_size, sizeof(size_t));
+	return mos_plane_encode(plane, fmt, level, stream, &encoded_size);
+}
+
+
+int mos_plane_read_sized(const mos_plane *plane, mos_attr_storage_fmt fmt, mos_stream *stream) {
+	const mos_plane_codec *codec = mos_find_codec(fmt);
+	size_t encoded_size;
+	if(codec == NULL) {
+		return MOS_EUNKNSTRGFMT;
+	}
+	if(codec->decode == NULL) {
+		return MOS_EUNSUPPORTED;
+	}
+	if(mos_stream_read(stream, &encoded_size, sizeof(size_t)) != sizeof(size_t)) {
+		return MOS_ETRUNCATED;
+	}
+	return codec->decode(plane, stream, encoded_size);
+}
+
+#undef EXCESS_SIZE
+#undef CODEC_CHUNK
@@ -0,0 +1,270 @@
+/*
+ * Copyright 2017 Gil Barbosa Reis <gilzoide@gmail.com>
+ * This file is part of libmosaic.
+ * 
+ * Libmosaic is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Libmosaic is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libmosaic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Any bugs should be reported to <gilzoide@gmail.com>
+ */
+
+#include "mosaic/diff.h"
+#include "internal.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+/// Changed cells closer than this are coalesced in a single run
+#define MERGE_GAP 8
+/// Size of the blank buffers that cells outside `from` are compared to
+#define BLANK_CHUNK 256
+
+static inline int max(int a, int b) {
+	return (a > b ? a : b);
+}
+
+static inline int min(int a, int b) {
+	return (a < b ? a : b);
+}
+
+mos_delta *mos_delta_new(void) {
+	mos_delta *delta = mos_malloc(NULL, sizeof(mos_delta));
+	if(delta) {
+		memset(delta, 0, sizeof(mos_delta));
+	}
+	return delta;
+}
+
+
+void mos_delta_free(mos_delta *delta) {
+	if(delta) {
+		mos_dealloc(NULL, delta->runs);
+		// attr shares the mosaic's allocation
+		mos_dealloc(NULL, delta->mosaic);
+		mos_dealloc(NULL, delta);
+	}
+}
+
+
+int mos_delta_reserve(mos_delta *delta, int runs, int cells) {
+	if(runs > delta->capacity) {
+		const int capacity = max(runs, delta->capacity + delta->capacity / 2);
+		mos_run *grown = mos_realloc(delta->runs, capacity * sizeof(mos_run));
+		if(grown == NULL) {
+			return MOS_EMALLOC;
+		}
+		delta->runs = grown;
+		delta->capacity = capacity;
+	}
+	if(cells > delta->cell_capacity) {
+		// both planes in a single block, so each one must be moved
+		const int capacity = max(cells, delta->cell_capacity + delta->cell_capacity / 2);
+		mos_char *grown = mos_malloc(NULL, capacity * (sizeof(mos_char) + sizeof(mos_attr)));
+		if(grown == NULL) {
+			return MOS_EMALLOC;
+		}
+		mos_attr *grown_attr = (mos_attr *) (grown + capacity);
+		if(delta->size > 0) {
+			memcpy(grown, delta->mosaic, delta->size * sizeof(mos_char));
+			memcpy(grown_attr, delta->attr, delta->size * sizeof(mos_attr));
+		}
+		mos_dealloc(NULL, delta->mosaic);
+		delta->mosaic = grown;
+		delta->attr = grown_attr;
+		delta->cell_capacity = capacity;
+	}
+	return MOS_OK;
+}
+
+
+/**
+ * Append a run to delta, with the cells of row y in img from x on.
+ */
+static int mos_delta_push(mos_delta *delta, MOSAIC *img, int y, int x, int width) {
+	if(mos_delta_reserve(delta, delta->count + 1, delta->size + width) != MOS_OK) {
+		return MOS_EMALLOC;
+	}
+	mos_run *run = delta->runs + delta->count++;
+	run->y = y;
+	run->x = x;
+	run->width = width;
+	run->offset = delta->size;
+	int done, k;
+	for(done = 0; done < width; done += k) {
+		mos_char *chars;
+		mos_attr *attrs;
+		k = min(width - done, mos_span(img, y, x + done, 0, &chars, &attrs));
+		memcpy(delta->mosaic + delta->size + done, chars, k * sizeof(mos_char));
+		memcpy(delta->attr + delta->size + done, attrs, k * sizeof(mos_attr));
+	}
+	delta->size += width;
+	return MOS_OK;
+}
+
+
+/**
+ * Index of the first cell that differs between a and b, in either plane,
+ * comparing a vector (or word) at a time.
+ *
+ * @return The index, or n if they're all equal
+ */
+static int mos_first_diff(const mos_char *a_chars, const mos_attr *a_attrs
+		, const mos_char *b_chars, const mos_attr *b_attrs, int n) {
+	int i = 0;
+#if defined(__AVX2__)
+	for( ; i + 32 <= n; i += 32) {
+		const __m256i chars = _mm256_cmpeq_epi8(
+				_mm256_loadu_si256((const __m256i *) (a_chars + i))
+				, _mm256_loadu_si256((const __m256i *) (b_chars + i)));
+		const __m256i attrs = _mm256_cmpeq_epi8(
+				_mm256_loadu_si256((const __m256i *) (a_attrs + i))
+				, _mm256_loadu_si256((const __m256i *) (b_attrs + i)));
+		const unsigned mask = ~(unsigned) _mm256_movemask_epi8(_mm256_and_si256(chars, attrs));
+		if(mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+#endif
+#if defined(__SSE2__)
+	for( ; i + 16 <= n; i += 16) {
+		const __m128i chars = _mm_cmpeq_epi8(
+				_mm_loadu_si128((const __m128i *) (a_chars + i))
+				, _mm_loadu_si128((const __m128i *) (b_chars + i)));
+		const __m128i attrs = _mm_cmpeq_epi8(
+				_mm_loadu_si128((const __m128i *) (a_attrs + i))
+				, _mm_loadu_si128((const __m128i *) (b_attrs + i)));
+		const unsigned mask = ~(unsigned) _mm_movemask_epi8(_mm_and_si128(chars, attrs)) & 0xFFFF;
+		if(mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+#else
+	for( ; i + 8 <= n; i += 8) {
+		uint64_t a_word, b_word, a_attr_word, b_attr_word;
+		memcpy(&a_word, a_chars + i, 8);
+		memcpy(&b_word, b_chars + i, 8);
+		memcpy(&a_attr_word, a_attrs + i, 8);
+		memcpy(&b_attr_word, b_attrs + i, 8);
+		if(a_word != b_word || a_attr_word != b_attr_word) {
+			break;
+		}
+	}
+#endif
+	for( ; i < n; i++) {
+		if(a_chars[i] != b_chars[i] || a_attrs[i] != b_attrs[i]) {
+			return i;
+		}
+	}
+	return n;
+}
+
+
+/**
+ * Index of the first cell that's equal in a and b, in both planes.
+ *
+ * @return The index, or n if they all differ
+ */
+static int mos_first_same(const mos_char *a_chars, const mos_attr *a_attrs
+		, const mos_char *b_chars, const mos_attr *b_attrs, int n) {
+	int i;
+	for(i = 0; i < n; i++) {
+		if(a_chars[i] == b_chars[i] && a_attrs[i] == b_attrs[i]) {
+			return i;
+		}
+	}
+	return n;
+}
+
+
+int mos_diff(mos_delta *delta, const MOSAIC *from, const MOSAIC *to) {
+	delta->height = to->height;
+	delta->width = to->width;
+	delta->count = 0;
+	delta->size = 0;
+
+	// cells outside `from` are compared to what resizing it would expose
+	mos_char blank_chars[BLANK_CHUNK];
+	mos_attr blank_attrs[BLANK_CHUNK];
+	memset(blank_chars, MOS_DEFAULT_CHAR, sizeof(blank_chars));
+	memset(blank_attrs, MOS_DEFAULT_ATTR, sizeof(blank_attrs));
+
+	int i, j, n;
+	for(i = 0; i < to->height; i++) {
+		// the run being built, [begin, end), not yet pushed
+		int begin = -1, end = -1;
+		// rows may be split in tiles, so go span by span
+		for(j = 0; j < to->width; j += n) {
+			mos_char *new_chars, *old_chars;
+			mos_attr *new_attrs, *old_attrs;
+			n = mos_span((MOSAIC *) to, i, j, 0, &new_chars, &new_attrs);
+			if(i < from->height && j < from->width) {
+				n = min(n, mos_span((MOSAIC *) from, i, j, 0, &old_chars, &old_attrs));
+			}
+			else {
+				old_chars = blank_chars;
+				old_attrs = blank_attrs;
+				n = min(n, BLANK_CHUNK);
+			}
+
+			int k = 0;
+			while((k += mos_first_diff(old_chars + k, old_attrs + k
+							, new_chars + k, new_attrs + k, n - k)) < n) {
+				const int same = k + mos_first_same(old_chars + k, old_attrs + k
+						, new_chars + k, new_attrs + k, n - k);
+				// too far from the last changes, so it's a new run
+				if(begin >= 0 && j + k - end >= MERGE_GAP) {
+					if(mos_delta_push(delta, (MOSAIC *) to, i, begin, end - begin) != MOS_OK) {
+						return MOS_EMALLOC;
+					}
+					begin = -1;
+				}
+				if(begin < 0) {
+					begin = j + k;
+				}
+				end = j + same;
+				k = same;
+			}
+		}
+		if(begin >= 0 && mos_delta_push(delta, (MOSAIC *) to, i, begin, end - begin) != MOS_OK) {
+			return MOS_EMALLOC;
+		}
+	}
+	return MOS_OK;
+}
+
+
+int mos_patch(MOSAIC *img, const mos_delta *delta) {
+	int ret;
+	if((img->height != delta->height || img->width != delta->width)
+			&& (ret = mos_resize(img, delta->height, delta->width)) != MOS_OK) {
+		return ret;
+	}
+	int i;
+	for(i = 0; i < delta->count; i++) {
+		const mos_run *run = delta->runs + i;
+		if(mos_set_cells(img, run->y, run->x, delta->mosaic + run->offset
+					, delta->attr + run->offset, run->width) != run->width) {
+			return MOS_EMALLOC;
+		}
+	}
+	return MOS_OK;
+}
+
+#undef BLANK_CHUNK
+#undef MERGE_GAP
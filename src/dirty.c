@@ -0,0 +1,257 @@
+/*
+ * Copyright 2017 Gil Barbosa Reis <gilzoide@gmail.com>
+ * This file is part of libmosaic.
+ * 
+ * Libmosaic is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Libmosaic is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libmosaic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Any bugs should be reported to <gilzoide@gmail.com>
+ */
+
+#include "mosaic/dirty.h"
+#include "internal.h"
+
+#include <string.h>
+
+/// Changed column range of a row: [begin, end), clean if begin >= end
+typedef struct {
+	int begin;
+	int end;
+} mos_dirty_range;
+
+struct mos_dirty {
+	int capacity;	///< number of rows there's room for
+	int top;	///< no row above this is dirty
+	int bottom;	///< no row below this is dirty
+	mos_dirty_range rows[];	///< the ranges, one per row
+};
+
+static inline int max(int a, int b) {
+	return (a > b ? a : b);
+}
+
+static inline int min(int a, int b) {
+	return (a < b ? a : b);
+}
+
+/**
+ * Allocate a dirty set with room for `capacity` rows, copying the first
+ * `height` ones from old, if any.
+ */
+static struct mos_dirty *mos_dirty_new(mos_arena *arena, int capacity
+		, const struct mos_dirty *old, int height) {
+	struct mos_dirty *dirty = mos_malloc(arena, sizeof(struct mos_dirty)
+			+ capacity * sizeof(mos_dirty_range));
+	if(dirty) {
+		dirty->capacity = capacity;
+		if(old) {
+			dirty->top = old->top;
+			dirty->bottom = old->bottom;
+			memcpy(dirty->rows, old->rows, height * sizeof(mos_dirty_range));
+		}
+		else {
+			dirty->top = capacity;
+			dirty->bottom = -1;
+			memset(dirty->rows, 0, capacity * sizeof(mos_dirty_range));
+		}
+	}
+	return dirty;
+}
+
+
+int mos_track_dirty(MOSAIC *img, int enable) {
+	if(img->parent) {
+		img = img->parent;
+	}
+	if(!enable) {
+		mos_dirty_free(img);
+	}
+	else if(img->dirty == NULL
+			&& (img->dirty = mos_dirty_new(img->arena, img->height, NULL, 0)) == NULL) {
+		return MOS_EMALLOC;
+	}
+	return MOS_OK;
+}
+
+
+void mos_dirty_add(MOSAIC *img, int y, int x, int height, int width) {
+	struct mos_dirty *dirty = img->dirty;
+	int i;
+	for(i = y; i < y + height; i++) {
+		mos_dirty_range *row = dirty->rows + i;
+		if(row->begin >= row->end) {
+			row->begin = x;
+			row->end = x + width;
+		}
+		else {
+			row->begin = min(row->begin, x);
+			row->end = max(row->end, x + width);
+		}
+	}
+	dirty->top = min(dirty->top, y);
+	dirty->bottom = max(dirty->bottom, y + height - 1);
+}
+
+
+int mos_dirty_reserve(MOSAIC *img, int height) {
+	struct mos_dirty *dirty = img->dirty;
+	if(dirty && height > dirty->capacity) {
+		struct mos_dirty *grown = mos_dirty_new(img->arena
+				, max(height, dirty->capacity + dirty->capacity / 2), dirty, img->height);
+		if(grown == NULL) {
+			return MOS_EMALLOC;
+		}
+		mos_dealloc(img->arena, dirty);
+		img->dirty = grown;
+	}
+	return MOS_OK;
+}
+
+
+void mos_dirty_resize(MOSAIC *img, int old_height, int old_width) {
+	struct mos_dirty *dirty = img->dirty;
+	int i;
+	// ranges can't go beyond the new width
+	for(i = 0; i < min(old_height, img->height); i++) {
+		dirty->rows[i].end = min(dirty->rows[i].end, img->width);
+	}
+	for(i = img->height; i < old_height; i++) {
+		dirty->rows[i].begin = dirty->rows[i].end = 0;
+	}
+	dirty->bottom = min(dirty->bottom, img->height - 1);
+	// and whatever's been exposed is new
+	if(img->width > old_width) {
+		mos_dirty_add(img, 0, old_width, min(old_height, img->height), img->width - old_width);
+	}
+	if(img->height > old_height) {
+		for(i = old_height; i < img->height; i++) {
+			dirty->rows[i].begin = dirty->rows[i].end = 0;
+		}
+		mos_dirty_add(img, old_height, 0, img->height - old_height, img->width);
+	}
+}
+
+
+void mos_dirty_free(MOSAIC *img) {
+	mos_dealloc(img->arena, img->dirty);
+	img->dirty = NULL;
+}
+
+
+/**
+ * Get the dirty range of row `y`, in img's coordinates.
+ *
+ * @return 1 if it's not empty
+ * @return 0 otherwise
+ */
+static int mos_dirty_range_of(const MOSAIC *img, int y, int *begin, int *end) {
+	const MOSAIC *root = img->parent ? img->parent : img;
+	const struct mos_dirty *dirty = root->dirty;
+	if(dirty == NULL || y < 0 || y >= img->height) {
+		return 0;
+	}
+	const mos_dirty_range *row = dirty->rows + img->begin_y + y;
+	*begin = max(row->begin - img->begin_x, 0);
+	*end = min(row->end - img->begin_x, img->width);
+	return *begin < *end;
+}
+
+
+/// First and last rows of img, in its own coordinates, that may be dirty
+static void mos_dirty_rows(const MOSAIC *img, int *first, int *last) {
+	const MOSAIC *root = img->parent ? img->parent : img;
+	*first = root->dirty ? max(root->dirty->top - img->begin_y, 0) : 0;
+	*last = root->dirty ? min(root->dirty->bottom - img->begin_y, img->height - 1) : -1;
+}
+
+
+int mos_is_dirty(const MOSAIC *img) {
+	int i, last, begin, end;
+	for(mos_dirty_rows(img, &i, &last); i <= last; i++) {
+		if(mos_dirty_range_of(img, i, &begin, &end)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+int mos_dirty_row(const MOSAIC *img, int y, int *x, int *width) {
+	int begin, end;
+	if(!mos_dirty_range_of(img, y, &begin, &end)) {
+		return 0;
+	}
+	*x = begin;
+	*width = end - begin;
+	return 1;
+}
+
+
+int mos_dirty_bbox(const MOSAIC *img, int *y, int *x, int *height, int *width) {
+	int i, last, begin, end;
+	int top = -1, bottom = -1, left = img->width, right = 0;
+	for(mos_dirty_rows(img, &i, &last); i <= last; i++) {
+		if(mos_dirty_range_of(img, i, &begin, &end)) {
+			if(top < 0) {
+				top = i;
+			}
+			bottom = i;
+			left = min(left, begin);
+			right = max(right, end);
+		}
+	}
+	if(top < 0) {
+		return 0;
+	}
+	*y = top;
+	*x = left;
+	*height = bottom - top + 1;
+	*width = right - left;
+	return 1;
+}
+
+
+void mos_clear_dirty(MOSAIC *img) {
+	MOSAIC *root = img->parent ? img->parent : img;
+	struct mos_dirty *dirty = root->dirty;
+	if(dirty == NULL) {
+		return;
+	}
+	int i, last;
+	for(mos_dirty_rows(img, &i, &last); i <= last; i++) {
+		mos_dirty_range *row = dirty->rows + img->begin_y + i;
+		const int begin = img->begin_x, end = img->begin_x + img->width;
+		if(row->begin >= begin && row->end <= end) {
+			row->begin = row->end = 0;
+		}
+		else if(row->begin >= begin && row->begin < end) {
+			row->begin = end;
+		}
+		else if(row->end > begin && row->end <= end) {
+			row->end = begin;
+		}
+	}
+	// close in on what's still dirty
+	while(dirty->top <= dirty->bottom
+			&& dirty->rows[dirty->top].begin >= dirty->rows[dirty->top].end) {
+		dirty->top++;
+	}
+	while(dirty->bottom >= dirty->top
+			&& dirty->rows[dirty->bottom].begin >= dirty->rows[dirty->bottom].end) {
+		dirty->bottom--;
+	}
+	if(dirty->top > dirty->bottom) {
+		dirty->top = root->height;
+		dirty->bottom = -1;
+	}
+}
@@ -27,5 +27,7 @@ const char * const mos_error_description[] = {
 	"Unknown attribute storage format",
 	"Compression error",
 	"Unsupported operation",
+	"Unexpected end of data, or output buffer too small",
+	"Corrupt data",
 };
 
@@ -0,0 +1,296 @@
+/*
+ * Copyright 2017 Gil Barbosa Reis <gilzoide@gmail.com>
+ * This file is part of libmosaic.
+ * 
+ * Libmosaic is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Libmosaic is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libmosaic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Any bugs should be reported to <gilzoide@gmail.com>
+ */
+
+#include "mosaic/hash.h"
+#include "internal.h"
+
+#include <string.h>
+
+/// Cells hashed at a time, gathered from spans if needed
+#define HASH_CHUNK 256
+
+struct mos_hashes {
+	int capacity;	///< number of rows there's room for
+	uint64_t rows[];	///< each row's hash, 0 if stale
+};
+
+/// Multipliers, the same as xxHash64's
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+
+static inline int max(int a, int b) {
+	return (a > b ? a : b);
+}
+
+static inline int min(int a, int b) {
+	return (a < b ? a : b);
+}
+
+static inline uint64_t rotl(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+/// Mix a word into the hash h
+static inline uint64_t mos_hash_word(uint64_t h, uint64_t word) {
+	h ^= rotl(word * PRIME2, 31) * PRIME1;
+	return rotl(h, 27) * PRIME1 + PRIME4;
+}
+
+/// Spread h's bits all over
+static inline uint64_t mos_hash_avalanche(uint64_t h) {
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+/**
+ * Mix n bytes into the hash h, a word at a time.
+ */
+static uint64_t mos_hash_bytes(uint64_t h, const void *data, int n) {
+	const unsigned char *bytes = data;
+	int i;
+	for(i = 0; i + 8 <= n; i += 8) {
+		uint64_t word;
+		memcpy(&word, bytes + i, 8);
+		h = mos_hash_word(h, word);
+	}
+	if(i < n) {
+		uint64_t word = 0;
+		memcpy(&word, bytes + i, n - i);
+		h = mos_hash_word(h, word);
+	}
+	return h;
+}
+
+
+/// Little endian word at bytes, whatever the host
+static inline uint64_t mos_load_le(const unsigned char *bytes) {
+	uint64_t word;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	memcpy(&word, bytes, 8);
+#else
+	int k;
+	for(word = 0, k = 0; k < 8; k++) {
+		word |= (uint64_t) bytes[k] << (8 * k);
+	}
+#endif
+	return word;
+}
+
+uint64_t mos_checksum(uint64_t h, const void *data, size_t n) {
+	const unsigned char *bytes = data;
+	size_t i = 0;
+	// 4 independent lanes while there's enough data, so multiplications
+	// don't wait on each other
+	if(n >= 32) {
+		uint64_t lanes[4] = { h + PRIME1 + PRIME2, h + PRIME2, h, h - PRIME1 };
+		int k;
+		for( ; i + 32 <= n; i += 32) {
+			for(k = 0; k < 4; k++) {
+				lanes[k] = mos_hash_word(lanes[k], mos_load_le(bytes + i + 8 * k));
+			}
+		}
+		h = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+	}
+	for( ; i + 8 <= n; i += 8) {
+		h = mos_hash_word(h, mos_load_le(bytes + i));
+	}
+	// the last word zero padded
+	if(i < n) {
+		uint64_t word = 0;
+		int k;
+		for(k = 0; i + k < n; k++) {
+			word |= (uint64_t) bytes[i + k] << (8 * k);
+		}
+		h = mos_hash_word(h, word);
+	}
+	return h;
+}
+
+
+/**
+ * Allocate row hashes with room for `capacity` rows, copying the first
+ * `height` ones from old, if any, all the others stale.
+ */
+static struct mos_hashes *mos_hashes_new(mos_arena *arena, int capacity
+		, const struct mos_hashes *old, int height) {
+	struct mos_hashes *hashes = mos_malloc(arena, sizeof(struct mos_hashes)
+			+ capacity * sizeof(uint64_t));
+	if(hashes) {
+		hashes->capacity = capacity;
+		memset(hashes->rows, 0, capacity * sizeof(uint64_t));
+		if(old) {
+			memcpy(hashes->rows, old->rows, height * sizeof(uint64_t));
+		}
+	}
+	return hashes;
+}
+
+
+int mos_track_hashes(MOSAIC *img, int enable) {
+	if(img->parent) {
+		img = img->parent;
+	}
+	if(!enable) {
+		mos_hashes_free(img);
+	}
+	else if(img->hashes == NULL
+			&& (img->hashes = mos_hashes_new(img->arena, img->height, NULL, 0)) == NULL) {
+		return MOS_EMALLOC;
+	}
+	return MOS_OK;
+}
+
+
+void mos_hashes_invalidate(MOSAIC *img, int y, int height) {
+	memset(img->hashes->rows + y, 0, height * sizeof(uint64_t));
+}
+
+
+int mos_hashes_reserve(MOSAIC *img, int height) {
+	struct mos_hashes *hashes = img->hashes;
+	if(hashes && height > hashes->capacity) {
+		struct mos_hashes *grown = mos_hashes_new(img->arena
+				, max(height, hashes->capacity + hashes->capacity / 2), hashes, img->height);
+		if(grown == NULL) {
+			return MOS_EMALLOC;
+		}
+		mos_dealloc(img->arena, hashes);
+		img->hashes = grown;
+	}
+	return MOS_OK;
+}
+
+
+void mos_hashes_free(MOSAIC *img) {
+	mos_dealloc(img->arena, img->hashes);
+	img->hashes = NULL;
+}
+
+
+/**
+ * Hash row y of img from its cells, a chunk at a time, so that the result
+ * doesn't depend on how the row is split in spans.
+ */
+static uint64_t mos_compute_row_hash(MOSAIC *img, int y) {
+	mos_char chunk_chars[HASH_CHUNK];
+	mos_attr chunk_attrs[HASH_CHUNK];
+	uint64_t h = PRIME3 + img->width;
+	int j, n;
+	for(j = 0; j < img->width; j += n) {
+		n = min(HASH_CHUNK, img->width - j);
+		mos_char *chars;
+		mos_attr *attrs;
+		int k = mos_span(img, y, j, 0, &chars, &attrs);
+		// split in spans, so gather them
+		if(k < n) {
+			int done;
+			for(done = 0; done < n; done += k) {
+				k = min(n - done, mos_span(img, y, j + done, 0, &chars, &attrs));
+				memcpy(chunk_chars + done, chars, k * sizeof(mos_char));
+				memcpy(chunk_attrs + done, attrs, k * sizeof(mos_attr));
+			}
+			chars = chunk_chars;
+			attrs = chunk_attrs;
+		}
+		h = mos_hash_bytes(h, chars, n * sizeof(mos_char));
+		h = mos_hash_bytes(h, attrs, n * sizeof(mos_attr));
+	}
+	h = mos_hash_avalanche(h);
+	// 0 means stale
+	return h ? h : 1;
+}
+
+
+/**
+ * Cached row hashes of img, if it's tracked and its rows are whole rows of
+ * the tracked MOSAIC, NULL otherwise. Row y of img is `hashes[y]`.
+ */
+static uint64_t *mos_row_hashes(const MOSAIC *img) {
+	const MOSAIC *root = img->parent ? img->parent : img;
+	if(root->hashes == NULL || img->begin_x != 0 || img->width != root->width) {
+		return NULL;
+	}
+	return root->hashes->rows + img->begin_y;
+}
+
+
+uint64_t mos_row_hash(const MOSAIC *img, int y) {
+	uint64_t *hashes = mos_row_hashes(img);
+	if(hashes == NULL) {
+		return mos_compute_row_hash((MOSAIC *) img, y);
+	}
+	if(hashes[y] == 0) {
+		hashes[y] = mos_compute_row_hash((MOSAIC *) img, y);
+	}
+	return hashes[y];
+}
+
+
+uint64_t mos_hash(const MOSAIC *img) {
+	uint64_t h = mos_hash_word(mos_hash_word(PRIME4, img->height), img->width);
+	int i;
+	for(i = 0; i < img->height; i++) {
+		h = mos_hash_word(h, mos_row_hash(img, i));
+	}
+	h = mos_hash_avalanche(h);
+	return h ? h : 1;
+}
+
+
+int mos_equal(const MOSAIC *a, const MOSAIC *b) {
+	if(a->height != b->height || a->width != b->width) {
+		return 0;
+	}
+	int i, j, n;
+	// tell them apart by hashes first, when it's cheap
+	if(mos_row_hashes(a) && mos_row_hashes(b)) {
+		for(i = 0; i < a->height; i++) {
+			if(mos_row_hash(a, i) != mos_row_hash(b, i)) {
+				return 0;
+			}
+		}
+	}
+	for(i = 0; i < a->height; i++) {
+		// rows may be split in tiles, so go span by span
+		for(j = 0; j < a->width; j += n) {
+			mos_char *a_chars, *b_chars;
+			mos_attr *a_attrs, *b_attrs;
+			n = mos_span((MOSAIC *) a, i, j, 0, &a_chars, &a_attrs);
+			n = min(n, mos_span((MOSAIC *) b, i, j, 0, &b_chars, &b_attrs));
+			if(memcmp(a_chars, b_chars, n * sizeof(mos_char))
+					|| memcmp(a_attrs, b_attrs, n * sizeof(mos_attr))) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+#undef PRIME4
+#undef PRIME3
+#undef PRIME2
+#undef PRIME1
+#undef HASH_CHUNK
@@ -21,10 +21,21 @@
 #include "mosaic/attr.h"
 #include "mosaic/error.h"
 #include "mosaic/image.h"
+#include "mosaic/tile.h"
+#include "internal.h"
 
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
 static inline int max(int a, int b) {
 	return (a > b ? a : b);
 }
@@ -38,11 +49,18 @@ int mos_is_inbounds(const MOSAIC *img, int y, int x) {
 }
 
 MOSAIC *mos_new(int height, int width) {
+	return mos_new_in(NULL, height, width);
+}
+
+
+MOSAIC *mos_new_in(mos_arena *arena, int height, int width) {
 	MOSAIC *img;
-	if((img = (MOSAIC *) calloc(1, sizeof(MOSAIC))) != NULL) {
+	if((img = (MOSAIC *) mos_malloc(arena, sizeof(MOSAIC))) != NULL) {
+		memset(img, 0, sizeof(MOSAIC));
+		img->arena = arena;
 		// alloc the dinamic stuff and fill it: something ResizeMOSAIC already does
 		if(mos_resize(img, height, width) != MOS_OK) {
-			free(img);
+			mos_dealloc(arena, img);
 			img = NULL;
 		}
 	}
@@ -56,227 +74,1198 @@ int mos_size(const MOSAIC *img) {
 }
 
 
+MOSAIC mos_view(MOSAIC *parent, int height, int width, int begin_y, int begin_x) {
+	MOSAIC view;
+	memset(&view, 0, sizeof(MOSAIC));
+	view.height = height;
+	view.width = width;
+	view.is_sub = 1;
+	// views of views refer directly to the outtermost MOSAIC
+	if(parent->parent) {
+		begin_y += parent->begin_y;
+		begin_x += parent->begin_x;
+		parent = parent->parent;
+	}
+	view.parent = parent;
+	view.begin_y = begin_y;
+	view.begin_x = begin_x;
+	return view;
+}
+
+
 MOSAIC *mos_submosaic(MOSAIC *parent, int height, int width, int begin_y, int begin_x) {
-	MOSAIC *img = malloc(sizeof(MOSAIC));
+	return mos_submosaic_in(NULL, parent, height, width, begin_y, begin_x);
+}
+
+
+MOSAIC *mos_submosaic_in(mos_arena *arena, MOSAIC *parent, int height, int width, int begin_y, int begin_x) {
+	// tiled MOSAICs have no rows to point to
+	if(mos_is_tiled(parent)) {
+		return NULL;
+	}
+	MOSAIC *img = mos_malloc(arena, sizeof(MOSAIC));
 	if(img == NULL) {
 		return NULL;
 	}
+	*img = mos_view(parent, height, width, begin_y, begin_x);
+	img->arena = arena;
 
-	img->height = height;
-	img->width = width;
-	img->is_sub = 1;	// hello, i'm a subMOSAIC
-
-	// allocate just the lines
-	// mosaic
-	img->mosaic = malloc(height * sizeof(mos_char *));
+	// allocate just the lines, both tables at once, so that
+	// img->mosaic[y][x] works as for any other MOSAIC
+	img->mosaic = mos_malloc(arena, height * (sizeof(mos_char *) + sizeof(mos_attr *)));
 	if(img->mosaic == NULL) {
-		free(img);
-		return NULL;
-	}
-	// attr
-	img->attr = malloc(height * sizeof(mos_attr *));
-	if(img->attr == NULL) {
-		free(img->mosaic);
-		free(img);
+		mos_dealloc(arena, img);
 		return NULL;
 	}
+	img->attr = (mos_attr **) (img->mosaic + height);
 
 	// now make mosaic/attr point to the parent MOSAIC at the right closure
 	int i;
 	for(i = 0; i < height; i++) {
-		// using pointer arithmetics, cuz it's cool
-		img->mosaic[i] = parent->mosaic[begin_y + i] + begin_x;
-		img->attr[i] = parent->attr[begin_y + i] + begin_x;
+		img->mosaic[i] = mos_char_row(img, i);
+		img->attr[i] = mos_attr_row(img, i);
 	}
 
+	// and have the parent keep them pointing there when its rows move,
+	// unless one may be released with an arena without the other knowing
+	if(arena == img->parent->arena) {
+		img->next_sub = img->parent->submosaics;
+		img->parent->submosaics = img;
+		img->is_tracked = 1;
+	}
 	return img;
 }
 
 
+/**
+ * Point a subMOSAIC's row `y` back into its parent's, or NULL if that's
+ * out of the parent's storage.
+ */
+static void mos_sub_point_row(MOSAIC *sub, int y) {
+	const MOSAIC *parent = sub->parent;
+	const int parent_y = sub->begin_y + y;
+	if(parent_y < parent->capacity_height && sub->begin_x < parent->capacity_width) {
+		sub->mosaic[y] = parent->mosaic[parent_y] + sub->begin_x;
+		sub->attr[y] = parent->attr[parent_y] + sub->begin_x;
+	}
+	else {
+		sub->mosaic[y] = NULL;
+		sub->attr[y] = NULL;
+	}
+}
+
+
+/**
+ * Point img's subMOSAICs' rows back into it after its row `y` moved, or all
+ * of its rows if y is negative.
+ */
+static void mos_refresh_submosaics(MOSAIC *img, int y) {
+	MOSAIC *sub;
+	for(sub = img->submosaics; sub; sub = sub->next_sub) {
+		if(y < 0) {
+			int i;
+			for(i = 0; i < sub->height; i++) {
+				mos_sub_point_row(sub, i);
+			}
+		}
+		else if(y >= sub->begin_y && y < sub->begin_y + sub->height) {
+			mos_sub_point_row(sub, y - sub->begin_y);
+		}
+	}
+}
+
+
 mos_char mos_set_char(MOSAIC *img, int y, int x, mos_char c) {
-	return (img->mosaic[y][x] = c);
+	mos_char *chars;
+	mos_attr *attrs;
+	if(mos_span(img, y, x, 1, &chars, &attrs) && *chars != c) {
+		*chars = c;
+		mos_mark_dirty(img, y, x, 1, 1);
+	}
+	return c;
 }
 
 
 mos_attr mos_set_attr(MOSAIC *img, int y, int x, mos_attr a) {
-	return (img->attr[y][x] = a);
+	mos_char *chars;
+	mos_attr *attrs;
+	if(mos_span(img, y, x, 1, &chars, &attrs) && *attrs != a) {
+		*attrs = a;
+		mos_mark_dirty(img, y, x, 1, 1);
+	}
+	return a;
 }
 
 
 mos_char mos_get_char(const MOSAIC *img, int y, int x) {
-	return img->mosaic[y][x];
+	mos_char *chars;
+	mos_attr *attrs;
+	mos_span((MOSAIC *) img, y, x, 0, &chars, &attrs);
+	return *chars;
 }
 
 
 mos_attr mos_get_attr(const MOSAIC *img, int y, int x) {
-	return img->attr[y][x];
+	mos_char *chars;
+	mos_attr *attrs;
+	mos_span((MOSAIC *) img, y, x, 0, &chars, &attrs);
+	return *attrs;
 }
 
 
-void mos_fill_char(MOSAIC *img, mos_char c) {
+/**
+ * Fill img's mosaic (plane 0) or attr (plane 1) with value.
+ */
+static void mos_fill_plane(MOSAIC *img, int plane, int value) {
+	mos_mark_dirty(img, 0, 0, img->height, img->width);
+	if(mos_is_tiled(img)) {
+		MOSAIC *root = img->parent ? img->parent : img;
+		mos_tiled_fill(root, img->begin_y, img->begin_x, img->height, img->width, plane, value);
+		return;
+	}
 	int i;
-	for(i = 0; i < img->height; i++) {
-		memset(img->mosaic[i], c, img->width * sizeof(mos_char));
+	for(i = 0; i < img->height && img->width > 0; i++) {
+		mos_char *chars;
+		mos_attr *attrs;
+		if(mos_span(img, i, 0, 1, &chars, &attrs)) {
+			memset(plane ? (void *) attrs : (void *) chars, value, img->width);
+		}
 	}
 }
 
 
+void mos_fill_char(MOSAIC *img, mos_char c) {
+	mos_fill_plane(img, 0, c);
+}
+
+
 void mos_fill_attr(MOSAIC *img, mos_attr a) {
-	int i;
-	for(i = 0; i < img->height; i++) {
-		memset(img->attr[i], a, img->width * sizeof(mos_attr));
-	}
+	mos_fill_plane(img, 1, a);
 }
 
 
 void mos_erase(MOSAIC *img) {
+	// a whole tiled MOSAIC is erased by just dropping its tiles
+	if(img->tiles) {
+		mos_tiled_clear(img);
+		mos_mark_dirty(img, 0, 0, img->height, img->width);
+		return;
+	}
 	mos_fill_char(img, MOS_DEFAULT_CHAR);
 	mos_fill_attr(img, MOS_DEFAULT_ATTR);
 }
 
 
-int mos_resize(MOSAIC *img, int new_height, int new_width) {
-	// old dimensions
-	const int old_height = img->height;
-	const int old_width = img->width;
-	// new dimensions
-	img->height = new_height;
-	img->width = new_width;
-	
-	int i;
-	// when shrinking the MOSAIC, free the lines we're discarding
-	for(i = old_height - 1; i >= new_height; i--) {
-		free(img->mosaic[i]);
-		free(img->attr[i]);
-	}
-	
-	
-	// realloc the dinamic stuff
-	// Lines
-	if((img->mosaic = realloc(img->mosaic, new_height * sizeof(mos_char *))) == NULL
-			|| (img->attr = realloc(img->attr, new_height * sizeof(mos_attr *))) == NULL) {
+/// Header of the reference counted blocks holding MOSAICs' data
+typedef struct {
+	int refcount;	///< number of MOSAICs holding the block
+	void *mapping;	///< file mapping rows may point into, released with the block
+	size_t mapping_size;	///< size of mapping
+} mos_block_header;
+
+/// Room before a block's data for its header, keeping data aligned
+#define BLOCK_HEADER 32
+
+/// Header of the block holding data
+static inline mos_block_header *mos_block_get_header(mos_char *data) {
+	return (mos_block_header *) (data - BLOCK_HEADER);
+}
+
+/// Reference count of the block holding data
+static inline int *mos_block_refcount(mos_char *data) {
+	return &mos_block_get_header(data)->refcount;
+}
+
+/// Size of a block holding both planes of plane_size cells
+static inline size_t mos_planes_size(size_t plane_size) {
+	return plane_size * (sizeof(mos_char) + sizeof(mos_attr));
+}
+
+/**
+ * Allocate a reference counted block of size bytes, usually both planes,
+ * see @ref mos_planes_size.
+ *
+ * @return The block's data, with a single reference
+ * @return NULL if allocation failed
+ */
+static mos_char *mos_block_new(mos_arena *arena, size_t size) {
+	mos_char *block = mos_malloc(arena, BLOCK_HEADER + size);
+	if(block == NULL) {
+		return NULL;
+	}
+	mos_block_header *header = (mos_block_header *) block;
+	header->refcount = 1;
+	header->mapping = NULL;
+	header->mapping_size = 0;
+	return block + BLOCK_HEADER;
+}
+
+/**
+ * Drop a reference to a block, releasing it if it was the last one.
+ *
+ * It is safe to pass a NULL pointer here.
+ */
+static void mos_block_release(mos_arena *arena, mos_char *data) {
+	if(data && --*mos_block_refcount(data) == 0) {
+		mos_block_header *header = mos_block_get_header(data);
+		if(header->mapping) {
+			mos_unmap(header->mapping, header->mapping_size);
+		}
+		mos_dealloc(arena, header);
+	}
+}
+
+
+int mos_attach_mapping(MOSAIC *img, void *mapping, size_t size) {
+	if(img->data == NULL) {
+		return 0;
+	}
+	mos_block_header *header = mos_block_get_header(img->data);
+	header->mapping = mapping;
+	header->mapping_size = size;
+	return 1;
+}
+
+
+/**
+ * Allocation holding img's row pointers.
+ *
+ * Row pointer tables of MOSAICs that own their data are rings: each table
+ * has the pointers to all capacity_height rows twice in a row, and
+ * MOSAIC::mosaic/MOSAIC::attr start at row_offset in them. This way
+ * rotating rows is just moving row_offset, and `img->mosaic[y]` still
+ * works without any wrapping around.
+ */
+static inline mos_char **mos_row_table(const MOSAIC *img) {
+	return img->mosaic - img->row_offset;
+}
+
+int mos_init_rows(MOSAIC *img, int height, int width) {
+	if(img->parent || img->tiles || img->mosaic || img->data) {
+		return MOS_EUNSUPPORTED;
+	}
+	mos_char **rows = mos_malloc(img->arena, 2 * height * (sizeof(mos_char *) + sizeof(mos_attr *)));
+	if(rows == NULL) {
+		return MOS_EMALLOC;
+	}
+	memset(rows, 0, 2 * height * (sizeof(mos_char *) + sizeof(mos_attr *)));
+	img->mosaic = rows;
+	img->attr = (mos_attr **) (rows + 2 * height);
+	img->row_offset = 0;
+	img->height = img->capacity_height = height;
+	img->width = img->capacity_width = width;
+	return MOS_OK;
+}
+
+
+mos_char *mos_init_block(MOSAIC *img, size_t size) {
+	return img->data = mos_block_new(img->arena, size);
+}
+
+
+void mos_set_row(MOSAIC *img, int y, mos_char *chars, mos_attr *attrs) {
+	const int capacity = img->capacity_height;
+	int i = (img->row_offset + y) % capacity;
+	mos_char **char_table = mos_row_table(img);
+	mos_attr **attr_table = img->attr - img->row_offset;
+	char_table[i] = char_table[i + capacity] = chars;
+	attr_table[i] = attr_table[i + capacity] = attrs;
+	if(img->submosaics) {
+		mos_refresh_submosaics(img, y);
+	}
+}
+
+
+/**
+ * Move img's contents to a new block with the given capacity, in one pass.
+ *
+ * Only the cells inside both the current dimensions and the new capacity
+ * are copied, the rest of the block is left uninitialized, as it will be
+ * blanked when exposed by @ref mos_resize. The new block is never shared.
+ */
+static int mos_relocate(MOSAIC *img, int capacity_height, int capacity_width) {
+	// pending blocks are decoded where they are, before rows move
+	if(img->lazy) {
+		mos_lazy_touch(img, 0, img->height);
+	}
+	const size_t plane_size = (size_t) capacity_height * capacity_width;
+	// both planes live in the same block: mosaic first, attr right after
+	mos_char *data = NULL;
+	if(plane_size > 0 && (data = mos_block_new(img->arena, mos_planes_size(plane_size))) == NULL) {
 		return MOS_EMALLOC;
 	}
-	// when growing, initialize lines with NULL, so realloc mallocs them
-	for(i = old_height; i < new_height; i++) {
-		img->mosaic[i] = NULL;
-		img->attr[i] = NULL;
+	// and so do the row pointer rings
+	mos_char **rows = NULL;
+	if(capacity_height > 0
+			&& (rows = mos_malloc(img->arena, 2 * capacity_height * (sizeof(mos_char *) + sizeof(mos_attr *)))) == NULL) {
+		mos_block_release(img->arena, data);
+		return MOS_EMALLOC;
 	}
+	mos_attr **attr_rows = (mos_attr **) (rows + 2 * capacity_height);
+	mos_attr *attr_data = (mos_attr *) (data + plane_size);
 
-	// Columns
-	for(i = 0; i < new_height; i++) {
-		if((img->mosaic[i] = realloc(img->mosaic[i], new_width * sizeof(mos_char))) == NULL
-				|| (img->attr[i] = realloc(img->attr[i], new_width * sizeof(mos_attr))) == NULL) {
-			return MOS_EMALLOC;
+	const int copy_height = min(img->height, capacity_height);
+	const int copy_width = min(img->width, capacity_width);
+	int i;
+	for(i = 0; i < capacity_height; i++) {
+		rows[i] = rows[i + capacity_height] = data + i * capacity_width;
+		attr_rows[i] = attr_rows[i + capacity_height] = attr_data + i * capacity_width;
+		if(i < copy_height && copy_width > 0) {
+			memcpy(rows[i], img->mosaic[i], copy_width * sizeof(mos_char));
+			memcpy(attr_rows[i], img->attr[i], copy_width * sizeof(mos_attr));
 		}
 	}
-	
-	// maybe it grew, so complete with blanks
-	// new lines, until old width
-	for(i = old_height; i < new_height; i++) {
-		memset(img->mosaic[i], MOS_DEFAULT_CHAR, old_width);
-		memset(img->attr[i], MOS_DEFAULT_ATTR, old_width);
+
+	mos_block_release(img->arena, img->data);
+	mos_block_release(img->arena, img->cow_data);
+	if(img->mosaic) {
+		mos_dealloc(img->arena, mos_row_table(img));
 	}
-	// new columns, until old height
-	if(new_width > old_width) {
-		for(i = 0; i < old_height; i++) {
-			memset(img->mosaic[i] + old_width, MOS_DEFAULT_CHAR, new_width - old_width);
-			memset(img->attr[i] + old_width, MOS_DEFAULT_ATTR, new_width - old_width);
+	img->data = data;
+	img->cow_data = NULL;
+	img->is_shared = 0;
+	img->mosaic = rows;
+	img->attr = attr_rows;
+	img->row_offset = 0;
+	img->capacity_height = capacity_height;
+	img->capacity_width = capacity_width;
+	img->height = min(img->height, capacity_height);
+	img->width = min(img->width, capacity_width);
+	mos_refresh_submosaics(img, -1);
+
+	return MOS_OK;
+}
+
+
+int mos_unshare_row(MOSAIC *img, int y) {
+	const size_t plane_size = (size_t) img->capacity_height * img->capacity_width;
+	mos_char *row = img->mosaic[y];
+	// rows not in the private block belong to data, even those pointing
+	// into a file mapping held by it
+	int in_cow = img->cow_data && row >= img->cow_data && row < img->cow_data + plane_size;
+	mos_char *block = in_cow ? img->cow_data : img->data;
+
+	if(block && *mos_block_refcount(block) > 1) {
+		// rows shared with a clone are copied to the private block, at the
+		// same place their ring slot has in the shared one
+		if(!in_cow && (img->cow_data == NULL || *mos_block_refcount(img->cow_data) == 1)) {
+			if(img->cow_data == NULL
+					&& (img->cow_data = mos_block_new(img->arena, mos_planes_size(plane_size))) == NULL) {
+				return MOS_EMALLOC;
+			}
+			const size_t offset = (size_t) ((img->row_offset + y) % img->capacity_height)
+					* img->capacity_width;
+			mos_char *cow_row = img->cow_data + offset;
+			mos_attr *cow_attr_row = (mos_attr *) (img->cow_data + plane_size) + offset;
+			memcpy(cow_row, row, img->width * sizeof(mos_char));
+			memcpy(cow_attr_row, img->attr[y], img->width * sizeof(mos_attr));
+			mos_set_row(img, y, cow_row, cow_attr_row);
+		}
+		// the private block got shared too: time to start over with a
+		// single private block
+		else {
+			return mos_relocate(img, img->capacity_height, img->capacity_width);
 		}
 	}
 
-	// the other rectangle: from old to new height/width
-	// (forgrowing on both directions)
-	if(new_width > old_width) {
-		for(i = old_height; i < new_height; i++) {
-			memset(img->mosaic[i] + old_width, MOS_DEFAULT_CHAR, new_width - old_width);
-			memset(img->attr[i] + old_width, MOS_DEFAULT_ATTR, new_width - old_width);
+	// clones may have been freed in the meantime
+	img->is_shared = *mos_block_refcount(img->data) > 1
+			|| (img->cow_data && *mos_block_refcount(img->cow_data) > 1);
+	return MOS_OK;
+}
+
+
+int mos_unshare(MOSAIC *img) {
+	if(img->parent) {
+		img = img->parent;
+	}
+	return img->is_shared
+			? mos_relocate(img, img->capacity_height, img->capacity_width)
+			: MOS_OK;
+}
+
+
+/**
+ * Capacity needed to hold `needed` cells, growing geometrically so that
+ * repeated growth is amortized.
+ */
+static int mos_grow_capacity(int capacity, int needed) {
+	return needed > capacity ? max(needed, capacity + capacity / 2) : capacity;
+}
+
+
+/**
+ * Resize a MOSAIC with dense storage, see @ref mos_resize, blanking what's
+ * been exposed only if `blank` is set.
+ */
+static int mos_dense_resize(MOSAIC *img, int new_height, int new_width, int blank) {
+	// only touch the allocation if it doesn't fit
+	if(new_height > img->capacity_height || new_width > img->capacity_width) {
+		int ret = mos_relocate(img
+				, mos_grow_capacity(img->capacity_height, new_height)
+				, mos_grow_capacity(img->capacity_width, new_width));
+		if(ret != MOS_OK) {
+			return ret;
 		}
 	}
 
+	// maybe it grew, so complete with blanks only what's been exposed
+	const int old_height = img->height;
+	const int old_width = img->width;
+	int i;
+	// new columns, until old height
+	if(blank && new_width > old_width) {
+		for(i = 0; i < min(old_height, new_height); i++) {
+			if(mos_own_row(img, i) != MOS_OK) {
+				return MOS_EMALLOC;
+			}
+			memset(img->mosaic[i] + old_width, MOS_DEFAULT_CHAR, (new_width - old_width) * sizeof(mos_char));
+			memset(img->attr[i] + old_width, MOS_DEFAULT_ATTR, (new_width - old_width) * sizeof(mos_attr));
+		}
+	}
+	// new lines, whole width
+	for(i = old_height; blank && i < new_height && new_width > 0; i++) {
+		if(mos_own_row(img, i) != MOS_OK) {
+			return MOS_EMALLOC;
+		}
+		memset(img->mosaic[i], MOS_DEFAULT_CHAR, new_width * sizeof(mos_char));
+		memset(img->attr[i], MOS_DEFAULT_ATTR, new_width * sizeof(mos_attr));
+	}
+
+	img->height = new_height;
+	img->width = new_width;
+
+	return MOS_OK;
+}
+
+
+/**
+ * Resize img, see @ref mos_resize, blanking what's been exposed only if
+ * `blank` is set.
+ */
+static int mos_resize_blanking(MOSAIC *img, int new_height, int new_width, int blank) {
+	// subMOSAICs and views don't own their data
+	if(img->parent) {
+		return MOS_EUNSUPPORTED;
+	}
+	// room for dirty rows and hashes first, so that it won't fail after resizing
+	int ret;
+	if((ret = mos_dirty_reserve(img, new_height)) != MOS_OK
+			|| (ret = mos_hashes_reserve(img, new_height)) != MOS_OK) {
+		return ret;
+	}
+	// blocks are laid out for the loaded dimensions
+	if(img->lazy && (new_height != img->height || new_width != img->width)) {
+		mos_lazy_touch(img, 0, img->height);
+	}
+	const int old_height = img->height;
+	const int old_width = img->width;
+	ret = img->tiles
+			? mos_tiled_resize(img, new_height, new_width)
+			: mos_dense_resize(img, new_height, new_width, blank);
+	if(ret == MOS_OK && img->dirty) {
+		mos_dirty_resize(img, old_height, old_width);
+	}
+	// every row's width may have changed
+	if(ret == MOS_OK && img->hashes) {
+		mos_hashes_invalidate(img, 0, new_height);
+	}
+	return ret;
+}
+
+
+int mos_resize(MOSAIC *img, int new_height, int new_width) {
+	return mos_resize_blanking(img, new_height, new_width, 1);
+}
+
+
+int mos_resize_uninit(MOSAIC *img, int new_height, int new_width) {
+	return mos_resize_blanking(img, new_height, new_width, 0);
+}
+
+
+int mos_reserve(MOSAIC *img, int height, int width) {
+	if(img->parent) {
+		return MOS_EUNSUPPORTED;
+	}
+	// tiles are allocated on demand, nothing to reserve
+	if(img->tiles) {
+		return MOS_OK;
+	}
+	if(height > img->capacity_height || width > img->capacity_width) {
+		return mos_relocate(img
+				, max(height, img->capacity_height)
+				, max(width, img->capacity_width));
+	}
+	return MOS_OK;
+}
+
+
+int mos_shrink_to_fit(MOSAIC *img) {
+	if(img->parent) {
+		return MOS_EUNSUPPORTED;
+	}
+	if(img->tiles) {
+		mos_tiled_shrink(img);
+		return MOS_OK;
+	}
+	if(img->height != img->capacity_height || img->width != img->capacity_width) {
+		return mos_relocate(img, img->height, img->width);
+	}
 	return MOS_OK;
 }
 
 
 void mos_copy(MOSAIC *dest, MOSAIC *src) {
 	int i, minWidth = min(dest->width, src->width), minHeight = min(dest->height, src->height);
+	mos_mark_dirty(dest, 0, 0, minHeight, minWidth);
 	for(i = 0; i < minHeight; i++) {
-		memcpy(dest->mosaic[i], src->mosaic[i], minWidth);
-		memcpy(dest->attr[i], src->attr[i], minWidth);
+		// rows may be split in tiles, so go span by span
+		int j = 0, n;
+		while(j < minWidth) {
+			mos_char *dest_chars, *src_chars;
+			mos_attr *dest_attrs, *src_attrs;
+			// dest first, as making it writable may move src's rows
+			if((n = mos_span(dest, i, j, 1, &dest_chars, &dest_attrs)) == 0) {
+				return;
+			}
+			n = min(n, mos_span(src, i, j, 0, &src_chars, &src_attrs));
+			n = min(n, minWidth - j);
+			memmove(dest_chars, src_chars, n * sizeof(mos_char));
+			memmove(dest_attrs, src_attrs, n * sizeof(mos_attr));
+			j += n;
+		}
 	}
 }
 
 MOSAIC *mos_clone(MOSAIC *src) {
 	MOSAIC *clone;
-	if(clone = mos_new(src->height, src->width)) {
-		mos_copy(clone, src);
+	if(src->tiles) {
+		return mos_tiled_clone(src);
+	}
+	// subMOSAICs don't own the whole data, and arena MOSAICs may be
+	// released before the clone, so these are deep copied
+	if(src->parent || src->arena) {
+		if(clone = mos_new(src->height, src->width)) {
+			mos_copy(clone, src);
+		}
+		return clone;
+	}
+
+	// shared rows must be complete
+	if(src->lazy) {
+		mos_lazy_touch(src, 0, src->height);
+	}
+	if((clone = mos_malloc(NULL, sizeof(MOSAIC))) == NULL) {
+		return NULL;
+	}
+	*clone = *src;
+	// changes are tracked by whoever asked for it, and subMOSAICs
+	// belong to src only
+	clone->dirty = NULL;
+	clone->hashes = NULL;
+	clone->submosaics = NULL;
+	// the clone needs its own row pointers, but shares the rows themselves
+	if(src->capacity_height > 0) {
+		const size_t rows_size = 2 * src->capacity_height * (sizeof(mos_char *) + sizeof(mos_attr *));
+		mos_char **rows = mos_malloc(NULL, rows_size);
+		if(rows == NULL) {
+			mos_dealloc(NULL, clone);
+			return NULL;
+		}
+		memcpy(rows, mos_row_table(src), rows_size);
+		clone->mosaic = rows + src->row_offset;
+		clone->attr = (mos_attr **) (rows + 2 * src->capacity_height) + src->row_offset;
+	}
+	if(src->data) {
+		++*mos_block_refcount(src->data);
+		if(src->cow_data) {
+			++*mos_block_refcount(src->cow_data);
+		}
+		src->is_shared = clone->is_shared = 1;
 	}
 	return clone;
 }
 
 
-int mos_trim(MOSAIC *target, char resize) {
+/**
+ * Index of the first char in s[0..n) that's not c, vectorized when possible.
+ *
+ * @return The index, or n if they're all c
+ */
+static int mos_scan_not(const mos_char *s, int n, mos_char c) {
+	int i = 0;
+#if defined(__AVX2__)
+	const __m256i c32 = _mm256_set1_epi8(c);
+	for( ; i + 32 <= n; i += 32) {
+		const __m256i chunk = _mm256_loadu_si256((const __m256i *) (s + i));
+		const unsigned mask = ~(unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, c32));
+		if(mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+#endif
+#if defined(__SSE2__)
+	const __m128i c16 = _mm_set1_epi8(c);
+	for( ; i + 16 <= n; i += 16) {
+		const __m128i chunk = _mm_loadu_si128((const __m128i *) (s + i));
+		const unsigned mask = ~(unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, c16)) & 0xFFFF;
+		if(mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+#endif
+	for( ; i < n; i++) {
+		if(s[i] != c) {
+			return i;
+		}
+	}
+	return n;
+}
+
+/**
+ * Index of the last char in s[0..n) that's not c, vectorized when possible.
+ *
+ * @return The index, or -1 if they're all c
+ */
+static int mos_scan_not_reverse(const mos_char *s, int n, mos_char c) {
+	int i = n;
+#if defined(__AVX2__)
+	const __m256i c32 = _mm256_set1_epi8(c);
+	for( ; i >= 32; i -= 32) {
+		const __m256i chunk = _mm256_loadu_si256((const __m256i *) (s + i - 32));
+		const unsigned mask = ~(unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, c32));
+		if(mask) {
+			return i - 32 + 31 - __builtin_clz(mask);
+		}
+	}
+#endif
+#if defined(__SSE2__)
+	const __m128i c16 = _mm_set1_epi8(c);
+	for( ; i >= 16; i -= 16) {
+		const __m128i chunk = _mm_loadu_si128((const __m128i *) (s + i - 16));
+		const unsigned mask = ~(unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, c16)) & 0xFFFF;
+		if(mask) {
+			return i - 16 + 31 - __builtin_clz(mask);
+		}
+	}
+#endif
+	while(i > 0) {
+		if(s[--i] != c) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+int mos_bbox(const MOSAIC *img, int *y, int *x, int *height, int *width) {
 	// Rectangle containing the mosaic without blank lines/columns
 	int ULy, ULx, BRy, BRx;
-	BRy = BRx = 0;
-	ULy = target->height - 1;
-	ULx = target->width - 1;
-	int i, j;
-	// check the mosaic
-	for(i = 0; i < target->height; i++) {
-		for(j = 0; j < target->width; j++) {
-			// it's not a blank, so update our rectangle
-			if(target->mosaic[i][j] != MOS_DEFAULT_CHAR) {
+	BRy = BRx = -1;
+	ULy = img->height;
+	ULx = img->width;
+	int i, j, n;
+	for(i = 0; i < img->height; i++) {
+		// rows may be split in tiles, so go span by span
+		for(j = 0; j < img->width; j += n) {
+			mos_char *chars;
+			mos_attr *attrs;
+			n = mos_span((MOSAIC *) img, i, j, 0, &chars, &attrs);
+			const int first = mos_scan_not(chars, n, MOS_DEFAULT_CHAR);
+			// it's not all blank, so update our rectangle
+			if(first < n) {
 				ULy = min(ULy, i);
-				ULx = min(ULx, j);
-				BRy = max(BRy, i);
-				BRx = max(BRx, j);
+				ULx = min(ULx, j + first);
+				BRy = i;
+				BRx = max(BRx, j + mos_scan_not_reverse(chars + first, n - first, MOS_DEFAULT_CHAR) + first);
 			}
 		}
 	}
 
+	if(BRy < 0) {
+		return 0;
+	}
+	*y = ULy;
+	*x = ULx;
+	*height = BRy - ULy + 1;
+	*width = BRx - ULx + 1;
+	return 1;
+}
+
+
+/**
+ * Set n cells of row y, from column x on, to char c and attribute a.
+ */
+static int mos_fill_cells(MOSAIC *img, int y, int x, int n, mos_char c, mos_attr a) {
+	int k;
+	for( ; n > 0; x += k, n -= k) {
+		mos_char *chars;
+		mos_attr *attrs;
+		if((k = mos_span(img, y, x, 1, &chars, &attrs)) == 0) {
+			return MOS_EMALLOC;
+		}
+		k = min(k, n);
+		memset(chars, c, k * sizeof(mos_char));
+		memset(attrs, a, k * sizeof(mos_attr));
+	}
+	return MOS_OK;
+}
+
+
+int mos_trim(MOSAIC *target, char resize) {
+	int ULy, ULx, height, width;
 	// only trim/resize if the entire mosaic is not blank
-	if(ULy <= BRy) {
-		// move the data from mosaic[src_y][src_x] to mosaic[i][j],
-		// but skip if it's already at (0,0)
-		if(ULy || ULx) {
-			int src_x, src_y;
-			for(src_y = ULy, i = 0; src_y <= BRy; src_y++, i++) {
-				for(src_x = ULx, j = 0; src_x <= BRx; src_x++, j++) {
-					target->mosaic[i][j] = target->mosaic[src_y][src_x];
-					target->mosaic[src_y][src_x] = MOS_DEFAULT_CHAR;
-					target->attr[i][j] = target->attr[src_y][src_x];
-					target->attr[src_y][src_x] = MOS_DEFAULT_ATTR;
+	if(!mos_bbox(target, &ULy, &ULx, &height, &width)) {
+		return MOS_OK;
+	}
+
+	// move the data from the rectangle to (0,0), row by row,
+	// but skip if it's already there
+	if(ULy || ULx) {
+		mos_mark_dirty(target, 0, 0, ULy + height, ULx + width);
+		int i, j, n;
+		for(i = 0; i < height; i++) {
+			for(j = 0; j < width; j += n) {
+				mos_char *dest_chars, *src_chars;
+				mos_attr *dest_attrs, *src_attrs;
+				// dest first, as making it writable may move src's rows
+				if((n = mos_span(target, i, j, 1, &dest_chars, &dest_attrs)) == 0) {
+					return MOS_EMALLOC;
 				}
+				n = min(n, mos_span(target, ULy + i, ULx + j, 0, &src_chars, &src_attrs));
+				n = min(n, width - j);
+				memmove(dest_chars, src_chars, n * sizeof(mos_char));
+				memmove(dest_attrs, src_attrs, n * sizeof(mos_attr));
 			}
 		}
+		// and blank what's left of the rectangle: everything below
+		// the moved data and what's at its right
+		for(i = ULy; i < ULy + height; i++) {
+			const int from = i < height ? max(ULx, width) : ULx;
+			if(mos_fill_cells(target, i, from, ULx + width - from, MOS_DEFAULT_CHAR, MOS_DEFAULT_ATTR) != MOS_OK) {
+				return MOS_EMALLOC;
+			}
+		}
+	}
+
+	// we already moved the mosaic to (0,0), so if
+	// asked to resize, just do it and we won't lose any data
+	if(resize) {
+		return mos_resize(target, height, width);
+	}
+
+	return MOS_OK;
+}
+
+
+/**
+ * Clip a rectangle to img's boundaries.
+ *
+ * @return 1 if something is left of it
+ * @return 0 if it's empty
+ */
+static int mos_clip(const MOSAIC *img, int *y, int *x, int *height, int *width) {
+	if(*y < 0) {
+		*height += *y;
+		*y = 0;
+	}
+	if(*x < 0) {
+		*width += *x;
+		*x = 0;
+	}
+	*height = min(*height, img->height - *y);
+	*width = min(*width, img->width - *x);
+	return *height > 0 && *width > 0;
+}
+
+
+void mos_fill_rect(MOSAIC *img, int y, int x, int height, int width, mos_char c, mos_attr a) {
+	if(!mos_clip(img, &y, &x, &height, &width)) {
+		return;
+	}
+	mos_mark_dirty(img, y, x, height, width);
+	// tiled fills know not to allocate blank tiles for blanks
+	if(mos_is_tiled(img)) {
+		MOSAIC *root = img->parent ? img->parent : img;
+		mos_tiled_fill(root, img->begin_y + y, img->begin_x + x, height, width, 0, c);
+		mos_tiled_fill(root, img->begin_y + y, img->begin_x + x, height, width, 1, a);
+		return;
+	}
+	int i;
+	for(i = y; i < y + height; i++) {
+		if(mos_fill_cells(img, i, x, width, c, a) != MOS_OK) {
+			return;
+		}
+	}
+}
+
 
-		// we already moved the mosaic to (0,0), so if
-		// asked to resize, just do it and we won't lose any data
-		if(resize) {
-			return mos_resize(target, BRy - ULy + 1, BRx - ULx + 1);
+/**
+ * Copy n cells from src_chars/src_attrs to dest_chars/dest_attrs, skipping
+ * the ones whose char is key, unless it's @ref MOS_NO_KEY. Overlapping
+ * cells are fine, as with `memmove`.
+ */
+static void mos_copy_keyed(mos_char *dest_chars, mos_attr *dest_attrs
+		, const mos_char *src_chars, const mos_attr *src_attrs, int n, int key) {
+	if(key == MOS_NO_KEY) {
+		memmove(dest_chars, src_chars, n * sizeof(mos_char));
+		memmove(dest_attrs, src_attrs, n * sizeof(mos_attr));
+		return;
+	}
+	int i = 0;
+	// moving to the right over itself: go backwards, so nothing is
+	// overwritten before being read
+	if(dest_chars > src_chars && dest_chars < src_chars + n) {
+		for(i = n - 1; i >= 0; i--) {
+			if((unsigned char) src_chars[i] != key) {
+				dest_chars[i] = src_chars[i];
+				dest_attrs[i] = src_attrs[i];
+			}
+		}
+		return;
+	}
+#if defined(__SSE2__)
+	const __m128i key16 = _mm_set1_epi8((char) key);
+	for( ; i + 16 <= n; i += 16) {
+		const __m128i src = _mm_loadu_si128((const __m128i *) (src_chars + i));
+		// where the key is, keep what's in dest
+		const __m128i keep = _mm_cmpeq_epi8(src, key16);
+		const __m128i chars = _mm_or_si128(_mm_and_si128(keep, _mm_loadu_si128((const __m128i *) (dest_chars + i)))
+				, _mm_andnot_si128(keep, src));
+		const __m128i attrs = _mm_or_si128(_mm_and_si128(keep, _mm_loadu_si128((const __m128i *) (dest_attrs + i)))
+				, _mm_andnot_si128(keep, _mm_loadu_si128((const __m128i *) (src_attrs + i))));
+		_mm_storeu_si128((__m128i *) (dest_chars + i), chars);
+		_mm_storeu_si128((__m128i *) (dest_attrs + i), attrs);
+	}
+#endif
+	for( ; i < n; i++) {
+		if((unsigned char) src_chars[i] != key) {
+			dest_chars[i] = src_chars[i];
+			dest_attrs[i] = src_attrs[i];
 		}
 	}
+}
+
+
+/// Cells moved at once when rows are split in spans
+#define MOVE_CHUNK 64
+
+/**
+ * Move n cells from src's row src_y, column src_x on, to dest's row dest_y,
+ * column dest_x on, skipping key chars.
+ *
+ * Dense rows are moved at once. Otherwise, cells go through a small buffer,
+ * chunk by chunk, from right to left when moving right, so that it works
+ * even if src and dest overlap.
+ */
+static int mos_move_cells(MOSAIC *dest, int dest_y, int dest_x
+		, MOSAIC *src, int src_y, int src_x, int n, int key) {
+	mos_char *dest_chars, *src_chars;
+	mos_attr *dest_attrs, *src_attrs;
+	// dest first, as making it writable may move src's rows
+	int dest_n = mos_span(dest, dest_y, dest_x, 1, &dest_chars, &dest_attrs);
+	if(dest_n == 0) {
+		return MOS_EMALLOC;
+	}
+	if(dest_n >= n && mos_span(src, src_y, src_x, 0, &src_chars, &src_attrs) >= n) {
+		mos_copy_keyed(dest_chars, dest_attrs, src_chars, src_attrs, n, key);
+		return MOS_OK;
+	}
 
+	const int backwards = dest->begin_x + dest_x > src->begin_x + src_x;
+	mos_char chars[MOVE_CHUNK];
+	mos_attr attrs[MOVE_CHUNK];
+	int done = 0;
+	while(done < n) {
+		const int k = min(MOVE_CHUNK, n - done);
+		const int offset = backwards ? n - done - k : done;
+		int i, got;
+		for(i = 0; i < k; i += got) {
+			got = min(k - i, mos_span(src, src_y, src_x + offset + i, 0, &src_chars, &src_attrs));
+			memcpy(chars + i, src_chars, got * sizeof(mos_char));
+			memcpy(attrs + i, src_attrs, got * sizeof(mos_attr));
+		}
+		for(i = 0; i < k; i += got) {
+			if((got = mos_span(dest, dest_y, dest_x + offset + i, 1, &dest_chars, &dest_attrs)) == 0) {
+				return MOS_EMALLOC;
+			}
+			got = min(k - i, got);
+			mos_copy_keyed(dest_chars, dest_attrs, chars + i, attrs + i, got, key);
+		}
+		done += k;
+	}
 	return MOS_OK;
 }
 
+#undef MOVE_CHUNK
+
+
+void mos_blit(MOSAIC *dest, int dest_y, int dest_x
+		, const MOSAIC *src, int src_y, int src_x, int height, int width, int key) {
+	// clip against src, then against dest, moving the other one along
+	int y = src_y, x = src_x;
+	if(!mos_clip(src, &y, &x, &height, &width)) {
+		return;
+	}
+	dest_y += y - src_y;
+	dest_x += x - src_x;
+	src_y = y;
+	src_x = x;
+	y = dest_y;
+	x = dest_x;
+	if(!mos_clip(dest, &y, &x, &height, &width)) {
+		return;
+	}
+	src_y += y - dest_y;
+	src_x += x - dest_x;
+	dest_y = y;
+	dest_x = x;
+	mos_mark_dirty(dest, dest_y, dest_x, height, width);
+
+	// moving down over itself: go bottom up, so nothing is overwritten
+	// before being read
+	const MOSAIC *dest_root = dest->parent ? dest->parent : dest;
+	const MOSAIC *src_root = src->parent ? src->parent : src;
+	const int bottom_up = dest_root == src_root
+			&& dest->begin_y + dest_y > src->begin_y + src_y;
+	int i;
+	for(i = 0; i < height; i++) {
+		const int row = bottom_up ? height - 1 - i : i;
+		if(mos_move_cells(dest, dest_y + row, dest_x
+				, (MOSAIC *) src, src_y + row, src_x, width, key) != MOS_OK) {
+			return;
+		}
+	}
+}
+
+
+/**
+ * Scroll a MOSAIC that owns its rows up by `lines` rows (down if negative)
+ * in O(lines), rotating its row pointer ring and blanking the exposed rows.
+ */
+static void mos_rotate_rows(MOSAIC *img, int lines) {
+	if(img->lazy) {
+		mos_lazy_touch(img, 0, img->height);
+	}
+	const int capacity = img->capacity_height;
+	const int offset = ((img->row_offset + lines) % capacity + capacity) % capacity;
+	mos_char **char_table = mos_row_table(img);
+	mos_attr **attr_table = img->attr - img->row_offset;
+	img->row_offset = offset;
+	img->mosaic = char_table + offset;
+	img->attr = attr_table + offset;
+	mos_refresh_submosaics(img, -1);
+	// every row moved
+	mos_mark_dirty(img, 0, 0, img->height, img->width);
+	mos_fill_rect(img, lines > 0 ? img->height - lines : 0, 0, abs(lines), img->width
+			, MOS_DEFAULT_CHAR, MOS_DEFAULT_ATTR);
+}
+
+
+void mos_scroll(MOSAIC *img, int lines, int columns) {
+	// rows of a MOSAIC that owns them just go round, whatever its size
+	if(lines && !img->parent && !img->tiles && abs(lines) < img->height) {
+		mos_rotate_rows(img, lines);
+		lines = 0;
+	}
+	if(!lines && !columns) {
+		return;
+	}
+
+	const int height = img->height - abs(lines);
+	const int width = img->width - abs(columns);
+	// everything scrolled out
+	if(height <= 0 || width <= 0) {
+		mos_erase(img);
+		return;
+	}
+
+	mos_blit(img, max(-lines, 0), max(-columns, 0)
+			, img, max(lines, 0), max(columns, 0), height, width, MOS_NO_KEY);
+
+	// blank what's been exposed: whole rows, then columns on the others
+	if(lines) {
+		mos_fill_rect(img, lines > 0 ? height : 0, 0, abs(lines), img->width
+				, MOS_DEFAULT_CHAR, MOS_DEFAULT_ATTR);
+	}
+	if(columns) {
+		mos_fill_rect(img, max(-lines, 0), columns > 0 ? width : 0, height, abs(columns)
+				, MOS_DEFAULT_CHAR, MOS_DEFAULT_ATTR);
+	}
+}
+
+
+/**
+ * Clip n cells at row y, column x on to img's boundaries.
+ *
+ * @param[in]     img  Target MOSAIC
+ * @param[in]     y    Y coordinate
+ * @param[in,out] x    X coordinate, moved to 0 if negative
+ * @param[out]    skip How many of the cells were clipped at the left
+ * @param[in]     n    Number of cells, INT_MAX for up to the right edge
+ *
+ * @return The number of cells left, 0 if none
+ */
+static int mos_clip_cells(const MOSAIC *img, int y, int *x, int *skip, int n) {
+	*skip = 0;
+	if(y < 0 || y >= img->height || n <= 0) {
+		return 0;
+	}
+	if(*x < 0) {
+		// all cut, checked before negating x, which may be INT_MIN
+		if(*x <= -n) {
+			return 0;
+		}
+		*skip = -*x;
+		*x = 0;
+	}
+	return max(0, min(n - *skip, img->width - *x));
+}
+
+
+/**
+ * Write n already clipped cells in row y, from column x on: chars from
+ * `chars` unless it's NULL, attributes from `attrs`, or all of them `a`
+ * if attrs is NULL and a is not negative.
+ *
+ * @return The number of cells written
+ */
+static int mos_write_cells(MOSAIC *img, int y, int x
+		, const mos_char *chars, const mos_attr *attrs, int a, int n) {
+	int done, k;
+	for(done = 0; done < n; done += k) {
+		mos_char *dest_chars;
+		mos_attr *dest_attrs;
+		if((k = mos_span(img, y, x + done, 1, &dest_chars, &dest_attrs)) == 0) {
+			break;
+		}
+		k = min(k, n - done);
+		if(chars) {
+			memcpy(dest_chars, chars + done, k * sizeof(mos_char));
+		}
+		if(attrs) {
+			memcpy(dest_attrs, attrs + done, k * sizeof(mos_attr));
+		}
+		else if(a >= 0) {
+			memset(dest_attrs, a, k * sizeof(mos_attr));
+		}
+	}
+	mos_mark_dirty(img, y, x, 1, done);
+	return done;
+}
+
+
+int mos_set_str(MOSAIC *img, int y, int x, const char *str, mos_attr a) {
+	int skip;
+	// no need to measure more than what fits
+	int n = mos_clip_cells(img, y, &x, &skip, INT_MAX);
+	if(n == 0) {
+		return 0;
+	}
+	const char *end = memchr(str, '\0', skip + n);
+	if(end) {
+		n = (int) (end - str) - skip;
+		if(n <= 0) {
+			return 0;
+		}
+	}
+	return mos_write_cells(img, y, x, str + skip, NULL, a, n);
+}
+
+
+int mos_set_cells(MOSAIC *img, int y, int x, const mos_char *chars, const mos_attr *attrs, int n) {
+	int skip;
+	if((n = mos_clip_cells(img, y, &x, &skip, n)) == 0) {
+		return 0;
+	}
+	return mos_write_cells(img, y, x, chars ? chars + skip : NULL, attrs ? attrs + skip : NULL, -1, n);
+}
+
+
+/// Size of the stack buffer for mos_printf, bigger outputs are allocated
+#define PRINTF_BUFFER 256
+
+int mos_vprintf(MOSAIC *img, int y, int x, mos_attr a, const char *fmt, va_list args) {
+	int skip;
+	const int n = mos_clip_cells(img, y, &x, &skip, INT_MAX);
+	if(n == 0) {
+		return 0;
+	}
+	// vsnprintf always terminates the string, so it can't write to the
+	// row itself without clobbering a cell: format into a buffer, then
+	// copy what's kept at once
+	char stack_buffer[PRINTF_BUFFER];
+	va_list copy;
+	va_copy(copy, args);
+	const int len = vsnprintf(stack_buffer, PRINTF_BUFFER, fmt, copy);
+	va_end(copy);
+	// output that's all cut is never allocated, however far left x was
+	if(len <= skip) {
+		return 0;
+	}
+	const int kept = min(len - skip, n);
+	const size_t size = (size_t) skip + kept + 1;
+	char *buffer = stack_buffer;
+	if(size > PRINTF_BUFFER) {
+		if((buffer = mos_malloc(NULL, size)) == NULL) {
+			return 0;
+		}
+		vsnprintf(buffer, size, fmt, args);
+	}
+	const int written = mos_write_cells(img, y, x, buffer + skip, NULL, a, kept);
+	if(buffer != stack_buffer) {
+		mos_dealloc(NULL, buffer);
+	}
+	return written;
+}
+
+#undef PRINTF_BUFFER
+
+
+int mos_printf(MOSAIC *img, int y, int x, mos_attr a, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	int written = mos_vprintf(img, y, x, a, fmt, args);
+	va_end(args);
+	return written;
+}
+
 
 void mos_free(MOSAIC *img) {
 	if(img) {
-		// only free the mosaic/attr if img is an 
-		// independent MOSAIC (not a subMOSAIC)
-		if(!img->is_sub) {
-			int i;
-			for(i = 0; i < img->height; i++) {
-				free(img->attr[i]);
-				free(img->mosaic[i]);
+		if(img->tiles) {
+			mos_tiled_free(img);
+		}
+		mos_dirty_free(img);
+		mos_hashes_free(img);
+		mos_lazy_free(img);
+		// subMOSAICs leave their parent's list, and the ones left behind
+		// by a parent know it's gone
+		if(img->is_tracked && img->parent) {
+			MOSAIC **link = &img->parent->submosaics;
+			while(*link && *link != img) {
+				link = &(*link)->next_sub;
+			}
+			if(*link) {
+				*link = img->next_sub;
 			}
 		}
+		MOSAIC *sub;
+		for(sub = img->submosaics; sub; sub = sub->next_sub) {
+			sub->parent = NULL;
+		}
+		// only subMOSAICs don't own their data, and then it's NULL
+		// arena MOSAICs are released with the arena itself
+		mos_block_release(img->arena, img->data);
+		mos_block_release(img->arena, img->cow_data);
+		// attr row pointers share the mosaic's allocation
+		if(img->mosaic) {
+			mos_dealloc(img->arena, mos_row_table(img));
+		}
 
-		free(img->attr);
-		free(img->mosaic);
-
-		free(img);
+		mos_dealloc(img->arena, img);
 	}
 }
+
+#undef BLOCK_HEADER
@@ -0,0 +1,388 @@
+/*
+ * Copyright 2017 Gil Barbosa Reis <gilzoide@gmail.com>
+ * This file is part of libmosaic.
+ * 
+ * Libmosaic is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Libmosaic is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libmosaic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Any bugs should be reported to <gilzoide@gmail.com>
+ */
+
+/** @file internal.h
+ * Helpers shared between libmosaic's sources, not installed.
+ */
+
+#ifndef __MOSAIC_INTERNAL_H__
+#define __MOSAIC_INTERNAL_H__
+
+#include "mosaic/alloc.h"
+#include "mosaic/diff.h"
+#include "mosaic/error.h"
+#include "mosaic/image.h"
+#include "mosaic/io.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * Allocate memory from arena, or from the global allocator if it's NULL.
+ */
+void *mos_malloc(mos_arena *arena, size_t size);
+/**
+ * Reallocate memory from the global allocator.
+ */
+void *mos_realloc(void *ptr, size_t size);
+/**
+ * Release memory from the global allocator; arena memory (arena not NULL)
+ * is only released in bulk, so this does nothing.
+ */
+void mos_dealloc(mos_arena *arena, void *ptr);
+
+/**
+ * Point row y of img, which must own its rows, to chars/attrs, keeping both
+ * copies in the ring.
+ */
+void mos_set_row(MOSAIC *img, int y, mos_char *chars, mos_attr *attrs);
+
+/**
+ * Resize img like @ref mos_resize, but leave exposed cells of dense
+ * MOSAICs uninitialized, for loaders that will overwrite them all.
+ */
+int mos_resize_uninit(MOSAIC *img, int new_height, int new_width);
+
+/**
+ * Set an empty, dense img up as height x width with row pointers only,
+ * all NULL, to be placed with @ref mos_set_row: for loaders whose rows
+ * mostly live elsewhere, such as in a file mapping.
+ *
+ * @return MOS_OK on success
+ * @return MOS_EMALLOC on allocation errors
+ * @return MOS_EUNSUPPORTED if img isn't an empty dense MOSAIC
+ */
+int mos_init_rows(MOSAIC *img, int height, int width);
+
+/**
+ * Give img, set up by @ref mos_init_rows, a data block of size bytes, for
+ * the rows that need storage of their own.
+ *
+ * @return The block, which is img's data
+ * @return NULL if allocation failed
+ */
+mos_char *mos_init_block(MOSAIC *img, size_t size);
+
+/**
+ * Make img's data block hold a file mapping its rows point into, so that
+ * it's released only when no MOSAIC uses it anymore.
+ *
+ * @return 1 if attached
+ * @return 0 if img has no data block, so the mapping is not needed
+ */
+int mos_attach_mapping(MOSAIC *img, void *mapping, size_t size);
+/// Release a file mapping, see io.c
+void mos_unmap(void *mapping, size_t size);
+
+/**
+ * Lazy loading internals, see binary.c
+ */
+/// Decode img's pending blocks with rows in [y, y + height), img must be lazy (no parent resolution)
+int mos_lazy_touch(MOSAIC *img, int y, int height);
+/// Drop img's lazy loading state, if any, leaving pending rows as they are
+void mos_lazy_free(MOSAIC *img);
+
+/**
+ * Make sure row `y` of img, which must own its rows, is decoded if img was
+ * lazily loaded.
+ */
+static inline void mos_touch_row(const MOSAIC *img, int y) {
+	if(img->lazy) {
+		mos_lazy_touch((MOSAIC *) img, y, 1);
+	}
+}
+
+/**
+ * Row `y` of img's mosaic, resolving SubMOSAICs and views through their
+ * parent, so it is always the up to date storage.
+ */
+static inline mos_char *mos_char_row(const MOSAIC *img, int y) {
+	if(img->parent) {
+		mos_touch_row(img->parent, img->begin_y + y);
+		return img->parent->mosaic[img->begin_y + y] + img->begin_x;
+	}
+	mos_touch_row(img, y);
+	return img->mosaic[y];
+}
+
+/**
+ * Row `y` of img's attributes, resolving SubMOSAICs and views through their
+ * parent.
+ */
+static inline mos_attr *mos_attr_row(const MOSAIC *img, int y) {
+	if(img->parent) {
+		mos_touch_row(img->parent, img->begin_y + y);
+		return img->parent->attr[img->begin_y + y] + img->begin_x;
+	}
+	mos_touch_row(img, y);
+	return img->attr[y];
+}
+
+/**
+ * Slow path of @ref mos_own_row, for MOSAICs that share storage with
+ * clones: copy row `y` to img's private block if it's shared.
+ *
+ * @return @ref MOS_OK on success
+ * @return @ref MOS_EMALLOC on allocation errors
+ */
+int mos_unshare_row(MOSAIC *img, int y);
+
+/**
+ * Make sure row `y` can be written to without affecting clones, resolving
+ * SubMOSAICs and views through their parent.
+ *
+ * Every write to a MOSAIC's storage should be preceded by this.
+ *
+ * @return @ref MOS_OK on success
+ * @return @ref MOS_EMALLOC on allocation errors
+ */
+static inline int mos_own_row(MOSAIC *img, int y) {
+	if(img->parent) {
+		y += img->begin_y;
+		img = img->parent;
+	}
+	// pending rows are decoded first, or they'd overwrite what's written
+	mos_touch_row(img, y);
+	return img->is_shared ? mos_unshare_row(img, y) : MOS_OK;
+}
+
+/**
+ * Tiled storage internals, see tile.c
+ */
+/// Span of a tiled MOSAIC, see @ref mos_span (no parent resolution)
+int mos_tiled_span(MOSAIC *img, int y, int x, int write, mos_char **chars, mos_attr **attrs);
+/// Fill a rectangle of a tiled MOSAIC's mosaic (plane 0) or attr (plane 1)
+void mos_tiled_fill(MOSAIC *img, int y, int x, int height, int width, int plane, int value);
+/// Release all tiles, so the tiled MOSAIC is all blank
+void mos_tiled_clear(MOSAIC *img);
+/// Resize a tiled MOSAIC
+int mos_tiled_resize(MOSAIC *img, int new_height, int new_width);
+/// Release tiles that are all blank
+void mos_tiled_shrink(MOSAIC *img);
+/// Deep copy a tiled MOSAIC
+MOSAIC *mos_tiled_clone(MOSAIC *src);
+/// Release a tiled MOSAIC's tiles and grid, but not the MOSAIC itself
+void mos_tiled_free(MOSAIC *img);
+
+/**
+ * Dirty tracking internals, see dirty.c
+ */
+/// Record a rectangle as dirty, img must be tracked (no parent resolution)
+void mos_dirty_add(MOSAIC *img, int y, int x, int height, int width);
+/// Make room for `height` rows in img's dirty set, if it's tracked
+int mos_dirty_reserve(MOSAIC *img, int height);
+/// Update img's dirty set after a resize, marking what's been exposed
+void mos_dirty_resize(MOSAIC *img, int old_height, int old_width);
+/// Release img's dirty set, if any
+void mos_dirty_free(MOSAIC *img);
+
+/**
+ * Row hashes internals, see hash.c
+ */
+/// Mark `height` row hashes from y on as stale, img must be tracked
+void mos_hashes_invalidate(MOSAIC *img, int y, int height);
+/// Make room for `height` rows in img's row hashes, if it's tracked
+int mos_hashes_reserve(MOSAIC *img, int height);
+/// Release img's row hashes, if any
+void mos_hashes_free(MOSAIC *img);
+/// Mix n bytes into the checksum h, the same on every host, for files
+uint64_t mos_checksum(uint64_t h, const void *data, size_t n);
+
+/**
+ * Record a rectangle of img as changed, if its changes are tracked, and
+ * mark its rows' hashes as stale, resolving SubMOSAICs and views through
+ * their parent.
+ *
+ * Every write to a MOSAIC's storage should be followed by this.
+ */
+static inline void mos_mark_dirty(MOSAIC *img, int y, int x, int height, int width) {
+	if(img->parent) {
+		y += img->begin_y;
+		x += img->begin_x;
+		img = img->parent;
+	}
+	if(height <= 0 || width <= 0) {
+		return;
+	}
+	if(img->dirty) {
+		mos_dirty_add(img, y, x, height, width);
+	}
+	if(img->hashes) {
+		mos_hashes_invalidate(img, y, height);
+	}
+}
+
+/**
+ * Byte stream internals, see stream.c
+ */
+/// Where encoded data is read from or written to: a FILE, or memory
+typedef struct {
+	FILE *file;	///< the FILE, NULL for memory streams
+	unsigned char *data;	///< memory read from or written to
+	size_t length;	///< bytes in data to be read, or written so far
+	size_t capacity;	///< bytes data can hold, for writing
+	size_t pos;	///< position in data
+	int growable;	///< boolean: is data reallocated when writing past capacity?
+	int error;	///< @ref MOS_EMALLOC if growing data failed, @ref MOS_OK otherwise
+} mos_stream;
+
+/// Stream over file
+static inline mos_stream mos_file_stream(FILE *file) {
+	mos_stream stream = { file, NULL, 0, 0, 0, 0, MOS_OK };
+	return stream;
+}
+
+/// Stream reading the `size` bytes from data on
+static inline mos_stream mos_mem_stream(const void *data, size_t size) {
+	mos_stream stream = { NULL, (unsigned char *) data, size, size, 0, 0, MOS_OK };
+	return stream;
+}
+
+/// Slow path of @ref mos_stream_write, for memory writes past capacity
+size_t mos_stream_write_grow(mos_stream *stream, const void *p, size_t n);
+/// Position in stream, `ftell` style
+long mos_stream_tell(mos_stream *stream);
+/// Move stream's position, `fseek` style
+int mos_stream_seek(mos_stream *stream, long offset, int whence);
+
+/**
+ * Read up to n bytes from stream into p, `fread` style.
+ *
+ * @return The number of bytes read
+ */
+static inline size_t mos_stream_read(mos_stream *stream, void *p, size_t n) {
+	if(stream->file) {
+		return fread(p, sizeof(char), n, stream->file);
+	}
+	const size_t left = stream->pos < stream->length ? stream->length - stream->pos : 0;
+	if(n > left) {
+		n = left;
+	}
+	memcpy(p, stream->data + stream->pos, n);
+	stream->pos += n;
+	return n;
+}
+
+/// Next byte of stream, or EOF, `getc` style
+static inline int mos_stream_getc(mos_stream *stream) {
+	if(stream->file) {
+		return getc(stream->file);
+	}
+	return stream->pos < stream->length ? stream->data[stream->pos++] : EOF;
+}
+
+/**
+ * Write n bytes from p to stream, `fwrite` style.
+ *
+ * Memory streams that aren't growable drop what's past their capacity,
+ * but still count it in their length.
+ */
+static inline size_t mos_stream_write(mos_stream *stream, const void *p, size_t n) {
+	if(stream->file) {
+		return fwrite(p, sizeof(char), n, stream->file);
+	}
+	if(stream->pos > stream->capacity || stream->capacity - stream->pos < n) {
+		return mos_stream_write_grow(stream, p, n);
+	}
+	memcpy(stream->data + stream->pos, p, n);
+	stream->pos += n;
+	if(stream->pos > stream->length) {
+		stream->length = stream->pos;
+	}
+	return n;
+}
+
+/// Write a byte to stream, `putc` style
+static inline void mos_stream_putc(mos_stream *stream, int c) {
+	if(stream->file) {
+		putc(c, stream->file);
+		return;
+	}
+	const unsigned char byte = c;
+	mos_stream_write(stream, &byte, 1);
+}
+
+/**
+ * Storage format internals, see codec.c
+ */
+/// Rows of one of an image's planes, to be encoded or decoded
+typedef struct {
+	MOSAIC *image;	///< the image, whose rows must be owned if decoding
+	int plane;	///< 0 for the chars, 1 for the attributes
+	int y;	///< first row
+	int height;	///< number of rows
+	FILE *spool;	///< if not NULL, rows are read from it in order instead, into image's first row, for encoding
+} mos_plane;
+/// Boolean: is fmt a known storage format? See io.c
+char mos_is_valid_format(mos_attr_storage_fmt fmt);
+/// Encoded size for formats that find their end by themselves
+#define MOS_UNKNOWN_SIZE ((size_t) -1)
+/// Encode plane as fmt to stream, or only count it if stream is NULL
+int mos_plane_encode(const mos_plane *plane, mos_attr_storage_fmt fmt, int level, mos_stream *stream, size_t *size);
+/// Decode `size` bytes of plane encoded as fmt from stream, consuming them all
+int mos_plane_decode(const mos_plane *plane, mos_attr_storage_fmt fmt, mos_stream *stream, size_t size);
+/// Encode plane as fmt to stream, preceded by its size as a native size_t
+int mos_plane_write_sized(const mos_plane *plane, mos_attr_storage_fmt fmt, int level, mos_stream *stream);
+/// Decode plane as fmt from stream, preceded by its size as a native size_t
+int mos_plane_read_sized(const mos_plane *plane, mos_attr_storage_fmt fmt, mos_stream *stream);
+
+/// Make room for `runs` runs and `cells` cells in delta, see diff.c
+int mos_delta_reserve(mos_delta *delta, int runs, int cells);
+
+/**
+ * Get pointers to the cells of row `y`, from column `x` on, for reading or
+ * writing, whatever the storage: dense, tiled, shared with clones or
+ * through a parent.
+ *
+ * Cells are contiguous only up to the returned count, so bulk operations
+ * should work span by span. Dense rows are a single span.
+ *
+ * @param[in]  img   Target MOSAIC
+ * @param[in]  y     Y coordinate
+ * @param[in]  x     X coordinate, must be less than img's width
+ * @param[in]  write Boolean: will the cells be written to? If so, storage is
+ *                   unshared/allocated as needed
+ * @param[out] chars Pointer to the chars
+ * @param[out] attrs Pointer to the attributes
+ *
+ * @return Number of contiguous cells from x on
+ * @return 0 on allocation errors
+ */
+static inline int mos_span(MOSAIC *img, int y, int x, int write, mos_char **chars, mos_attr **attrs) {
+	const int n = img->width - x;
+	if(img->parent) {
+		y += img->begin_y;
+		x += img->begin_x;
+		img = img->parent;
+	}
+	mos_touch_row(img, y);
+	if(img->tiles) {
+		const int tiled_n = mos_tiled_span(img, y, x, write, chars, attrs);
+		return tiled_n < n ? tiled_n : n;
+	}
+	if(write && img->is_shared && mos_unshare_row(img, y) != MOS_OK) {
+		return 0;
+	}
+	*chars = img->mosaic[y] + x;
+	*attrs = img->attr[y] + x;
+	return n;
+}
+
+#endif
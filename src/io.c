@@ -19,15 +19,23 @@
  */
 
 #include "mosaic/io.h"
+#include "mosaic/binary.h"
 #include "mosaic/error.h"
-
-#ifdef ENABLE_ZLIB
-# include <zlib.h>
+#include "mosaic/tile.h"
+#include "internal.h"
+
+#ifdef ENABLE_MMAP
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
 #endif
 
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <ctype.h>
+#include <limits.h>
 
 /// Separator between text/binary representation on Mosaics
 #define SEPARATOR '\t'
@@ -35,216 +43,263 @@
 char mos_is_valid_format(mos_attr_storage_fmt fmt) {
 	return fmt == MOS_UNCOMPRESSED
 			|| fmt == MOS_COMPRESSED
+			|| fmt == MOS_RLE
+			|| fmt == MOS_ZSTD
+			|| fmt == MOS_LZ4
 			|| fmt == MOS_NO_ATTR;
 }
 
+
+/// Bytes of text read at a time by mos_fget
+#define TEXT_BLOCK 16384
+
+/// State of the text part parser, see mos_parse_text
+typedef struct {
+	MOSAIC *image;	///< image being read
+	int i;	///< current row
+	int j;	///< current column
+	int full;	///< boolean: is row i full, so a newline right after it is discarded?
+} mos_text_parser;
+
 /**
- * Compress the MOSAIC for writing it in stream, when using zlib compression
- *
- * It's just an auxiliary function for mos_fput, it's not even in the header
- * @note It expects that you have just read the SEPARATOR and the MOS_COMPRESSED
- * marks from the `stream'.
- *
- * @param[in] image The image to be saved
- * @param[out] stream The stream to be written to
- *
- * @return 0 on success
- * @return MOS_ECOMPRESSION for compression errors
+ * Parse a piece of the text part, which has no SEPARATOR, into the image's
+ * rows: each one is read until a newline or until it's full, a newline
+ * right after a full row being discarded. Line ends are found with
+ * `memchr` and whole rows copied at once.
  */
-int compressMOSAIC(const MOSAIC *image, FILE *stream) {
-#ifdef ENABLE_ZLIB
-	// accumulator: storage how much space is needed
-	size_t compressed_data_size = 0;
-	// and the zlib's stream
-	z_stream strm;
-	strm.zalloc = Z_NULL;
-	strm.zfree = Z_NULL;
-	strm.opaque = Z_NULL;
-	if(deflateInit(&strm, Z_DEFAULT_COMPRESSION) != Z_OK) {
-		return MOS_ECOMPRESSION;
-	}
-
-# define CHUNK	(image->width * sizeof(mos_attr))
-	// write each attr line
-	char loop = 1;
-	int i, flush = Z_NO_FLUSH;
-	mos_attr out[mos_size(image)];
-	Bytef *aux = (Bytef *) out;
-	for(i = 0; loop; i++) {
-		if(i == image->height - 1) {
-			loop = 0;
-			flush = Z_FINISH;
+static void mos_parse_text(mos_text_parser *t, const char *p, const char *end) {
+	MOSAIC *image = t->image;
+	while(p < end && t->i < image->height) {
+		if(t->full) {
+			if(*p == '\n') {
+				p++;
+			}
+			t->full = 0;
+			t->i++;
+			continue;
+		}
+		mos_char *row = image->mosaic[t->i];
+		const int room = image->width - t->j;
+		const int n = end - p < room ? end - p : room;
+		const char *newline = memchr(p, '\n', n);
+		if(newline) {
+			// reached newline before width, complete with whitespaces
+			const int length = newline - p;
+			memcpy(row + t->j, p, length);
+			memset(row + t->j + length, MOS_DEFAULT_CHAR, room - length);
+			p = newline + 1;
+			t->i++;
+			t->j = 0;
 		}
-		strm.avail_in = CHUNK;
-		strm.next_in = (Bytef *) image->attr[i];
+		else {
+			memcpy(row + t->j, p, n);
+			p += n;
+			if((t->j += n) == image->width) {
+				t->full = 1;
+				t->j = 0;
+			}
+		}
+	}
+}
 
-		do {
-			strm.avail_out = CHUNK;
-			strm.next_out = (Bytef *) aux;
 
-			if(deflate(&strm, flush) == Z_STREAM_ERROR) {
-				deflateEnd(&strm);
-				return MOS_ECOMPRESSION;
-			}
-			int have = CHUNK - strm.avail_out;
-			compressed_data_size += have;
-			aux += have;
-		} while(strm.avail_out == 0);
-	}
-# undef CHUNK
-	deflateEnd(&strm);
-	// now write the data into the stream
-	// first off, the data_size
-	fwrite(&compressed_data_size, sizeof(size_t), 1, stream);
-	// and now the compreessed data itself
-	fwrite(out, sizeof(char), compressed_data_size, stream);
-
-	return 0;
-#else
-	return MOS_EUNSUPPORTED;
-#endif
+/**
+ * Finish parsing the text part, which ended in a SEPARATOR or EOF: a row
+ * cut short by it is discarded, and it and the others left are blank.
+ *
+ * @return 1 if the last row was full right at the end of text
+ * @return 0 otherwise
+ */
+static int mos_parse_text_end(mos_text_parser *t) {
+	MOSAIC *image = t->image;
+	int last_full = 0;
+	if(t->full) {
+		t->i++;
+		last_full = t->i == image->height;
+	}
+	for( ; t->i < image->height; t->i++) {
+		memset(image->mosaic[t->i], MOS_DEFAULT_CHAR, image->width * sizeof(mos_char));
+	}
+	return last_full;
 }
 
 
 /**
- * Decompress the MOSAIC read from stream, when using zlib compression
+ * Read the text part from stream up to the SEPARATOR, which is consumed,
+ * or EOF, parsing it on the way.
  *
- * It's just an auxiliary function for mos_fget, it's not even in the header
- * @note It expects that you have just read the SEPARATOR and the MOS_COMPRESSED
- * marks from the `stream'.
+ * Memory streams are parsed right where they are. Seekable FILE streams
+ * are read a block at a time, then sought back to right after the
+ * SEPARATOR; other streams, a char at a time, so that nothing after it is
+ * consumed.
  *
- * @param[in] image The image to be saved
- * @param[out] stream The stream to be written to
+ * @return SEPARATOR or EOF, whatever ended the text part
+ */
+static int mos_read_text(mos_text_parser *t, mos_stream *stream) {
+	if(stream->file == NULL) {
+		const char *p = (const char *) stream->data + stream->pos;
+		const size_t left = stream->pos < stream->length ? stream->length - stream->pos : 0;
+		const char *separator = memchr(p, SEPARATOR, left);
+		mos_parse_text(t, p, separator ? separator : p + left);
+		stream->pos = separator ? (size_t) (separator + 1 - (const char *) stream->data) : stream->pos + left;
+		return separator ? SEPARATOR : EOF;
+	}
+
+	FILE *file = stream->file;
+	char block[TEXT_BLOCK];
+	size_t n;
+	if(fseek(file, 0, SEEK_CUR) == 0) {
+		while((n = fread(block, 1, TEXT_BLOCK, file)) > 0) {
+			const char *separator = memchr(block, SEPARATOR, n);
+			if(separator) {
+				mos_parse_text(t, block, separator);
+				fseek(file, (long) (separator + 1 - block) - (long) n, SEEK_CUR);
+				return SEPARATOR;
+			}
+			mos_parse_text(t, block, block + n);
+		}
+		return EOF;
+	}
+
+	int c;
+	for(n = 0; (c = getc(file)) != EOF && c != SEPARATOR; ) {
+		block[n++] = c;
+		if(n == TEXT_BLOCK) {
+			mos_parse_text(t, block, block + n);
+			n = 0;
+		}
+	}
+	mos_parse_text(t, block, block + n);
+	return c;
+}
+
+#undef TEXT_BLOCK
+
+
+/**
+ * Parse an int from a memory stream, `scanf("%d")` style: whitespace
+ * before it is skipped, and it's consumed only if there's a number.
  *
- * @return MOS_OK on success
- * @return MOS_ECOMPRESSION for decompression errors
- * @return MOS_EUNSUPPORTED if compression is not supported
+ * @return 1 if a number was parsed
+ * @return 0 if there's something else
+ * @return EOF if the data ended before anything but whitespace
  */
-int uncompressMOSAIC(MOSAIC *image, FILE *stream) {
-#ifdef ENABLE_ZLIB
-	// the auxiliary array, for writing the compressed data 
-	mos_attr in[mos_size(image) + 2];
-	mos_attr out[mos_size(image)];
-	// and the zlib's stream
-	z_stream strm;
-	strm.zalloc = Z_NULL;
-	strm.zfree = Z_NULL;
-	strm.opaque = Z_NULL;
-	strm.avail_in = 0;
-	strm.next_in = Z_NULL;
-	if(inflateInit(&strm) != Z_OK) {
-		return MOS_ECOMPRESSION;
-	}
-
-	size_t compressed_data_size;
-	fread(&compressed_data_size, sizeof(size_t), 1, stream);
-	// read it all to `in', and inflate to `out'
-	strm.avail_in = fread(in, sizeof(char), compressed_data_size, stream);
-	strm.next_in = (Bytef *) in;
-
-	strm.avail_out = mos_size(image) * sizeof(mos_attr);
-	strm.next_out = (Bytef *) out;
-
-	if(inflate(&strm, Z_NO_FLUSH) == Z_STREAM_ERROR) {
-		inflateEnd(&strm);
-		return MOS_ECOMPRESSION;
-	}
-	inflateEnd(&strm);
-
-	// and copy it back into the mosaic
-	mos_attr *aux = out;
-	int i;
-	for(i = 0; i < image->height; i++) {
-		memcpy(image->attr[i], aux, image->width * sizeof(mos_attr));
-		aux += image->width;
+static int mos_scan_int(mos_stream *stream, int *value) {
+	const unsigned char *p = stream->data + stream->pos, *end = stream->data + stream->length;
+	while(p < end && isspace(*p)) {
+		p++;
+	}
+	if(p == end) {
+		return EOF;
+	}
+	const int negative = *p == '-';
+	if(*p == '-' || *p == '+') {
+		p++;
+	}
+	if(p == end || !isdigit(*p)) {
+		return 0;
 	}
+	// too big numbers saturate, as with strtol
+	long n = 0;
+	for( ; p < end && isdigit(*p); p++) {
+		n = n > (LONG_MAX - 9) / 10 ? LONG_MAX : n * 10 + (*p - '0');
+	}
+	*value = (int) (negative ? -n : n);
+	stream->pos = p - stream->data;
+	return 1;
+}
 
-	return 0;
-#else
-	return MOS_EUNSUPPORTED;
-#endif
+
+/**
+ * Read the dimensions header, `fscanf(stream, "%dx%d", ...)` style.
+ *
+ * @return The number of dimensions read, or EOF
+ */
+static int mos_scan_dimensions(mos_stream *stream, int *height, int *width) {
+	if(stream->file) {
+		return fscanf(stream->file, "%dx%d", height, width);
+	}
+	int ret = mos_scan_int(stream, height);
+	if(ret == 1 && stream->pos < stream->length && stream->data[stream->pos] == 'x') {
+		stream->pos++;
+		ret += mos_scan_int(stream, width) == 1;
+	}
+	return ret;
 }
 
-int mos_fget(MOSAIC *image, FILE *stream) {
+
+/**
+ * Read a .mosi image from stream, see @ref mos_fget.
+ */
+static int mos_get(MOSAIC *image, mos_stream *stream) {
+	if(mos_is_tiled(image)) {
+		return MOS_EUNSUPPORTED;
+	}
 	int new_height, new_width;
-	int dim_return = fscanf(stream, "%3dx%3d", &new_height, &new_width);
-	if(!dim_return || dim_return == EOF) {
+	if(mos_scan_dimensions(stream, &new_height, &new_width) != 2
+			|| new_height < 0 || new_width < 0) {
 		return MOS_ENODIMENSIONS;
 	}
 	
+	// whatever was pending is overwritten anyway
+	mos_lazy_free(image);
 	// try to resize, get out if trouble
 	int ret;
-	if((ret = mos_resize(image, new_height, new_width)) != MOS_OK) {
+	if((ret = mos_resize(image, new_height, new_width)) != MOS_OK
+			|| (ret = mos_unshare(image)) != MOS_OK) {
 		return ret;
 	}
+	// everything is (possibly) overwritten
+	mos_mark_dirty(image, 0, 0, image->height, image->width);
 
-	int c;
-	// there's supposed to have a '\n' to discard after %dx%d;
-	// but if there ain't one, we read what's after
-	if((c = fgetc(stream)) != '\n') {
-		ungetc(c, stream);
+	mos_text_parser text = { image, 0, 0, 0 };
+	// rows with no width never read a thing, so their text is all skipped
+	if(image->width == 0) {
+		text.i = image->height;
 	}
-	
-	int i, j;
-	for(i = 0; i < image->height; i++) {
-		// read the line until the end or no more width is available
-		for(j = 0; j < image->width; j++) {
-			c = fgetc(stream);
-			if(c == SEPARATOR || c == EOF) {
-				// used so won't need a flag or more comparisons
-				// to break both the fors
-				goto FILL_WITH_BLANK;
-			}
-			// if it reached newline before width...
-			else if(c == '\n') {
-				break;
-			}
-			image->mosaic[i][j] = c;
-		}
-		// ...complete with whitespaces
-		for( ;  j < image->width; j++) {
-			image->mosaic[i][j] = MOS_DEFAULT_CHAR;
-		}
-		
-		// we read the whole line, but the tailing '\n', we need to discard it
+	// there's supposed to have a '\n' to discard after %dx%d;
+	// but if there ain't one, it's text
+	int c = mos_stream_getc(stream);
+	const int header_separator = c == SEPARATOR;
+	if(c != SEPARATOR && c != EOF) {
 		if(c != '\n') {
-			// may happen it's not a newline yet, so let's reread it =P
-			if((c = fgetc(stream)) != '\n') {
-				ungetc(c, stream);
-			}
-		}
-	}
-	
-FILL_WITH_BLANK:
-	// well, maybe we reached EOF or SEPARATOR, so everything else is a blank...
-	for( ; i < image->height; i++) {
-		for(j = 0;  j < image->width; j++) {
-			image->mosaic[i][j] = MOS_DEFAULT_CHAR;
+			const char first = c;
+			mos_parse_text(&text, &first, &first + 1);
 		}
+		c = mos_read_text(&text, stream);
 	}
+	const int last_full = mos_parse_text_end(&text);
 
-	// jump to the SEPARATOR, if it exists
-	while(c != SEPARATOR && c != EOF) {
-		c = fgetc(stream);
-	}
 	// if SEPARATOR, and not EOF, read the next char, which hopely 
-	// will be the format
-	if(c != EOF) {
-		c = fgetc(stream);
+	// will be the format. A SEPARATOR right after the last full row (or
+	// right after the header, if there are no rows to read) has always
+	// been read as the format itself, so keep it that way
+	if(c == SEPARATOR && !last_full
+			&& !(header_separator && (image->height == 0 || image->width == 0))) {
+		c = mos_stream_getc(stream);
 	}
 
 	// Time for some Attributes! (color/bold)
+	const mos_plane attr_plane = { image, 1, 0, image->height, NULL };
+	int i;
 	switch(c) {
 		case MOS_UNCOMPRESSED:
-			; size_t check = image->width;
-			for(i = 0; check == image->width && i < image->width; i++) {
-				check = fread(image->attr[i], sizeof(mos_attr), image->width, stream);
+			; const size_t row_size = image->width * sizeof(mos_attr);
+			size_t check = row_size;
+			for(i = 0; check == row_size && i < image->height; i++) {
+				check = mos_stream_read(stream, image->attr[i], row_size);
 			}
 			break;
 
-		// uncompress with zlib (if supported)
+		// decompress with zlib, zstd or lz4 (if supported)
 		case MOS_COMPRESSED:
-			return uncompressMOSAIC(image, stream);
+		case MOS_ZSTD:
+		case MOS_LZ4:
+			return mos_plane_read_sized(&attr_plane, c, stream);
+
+		// run-length encoded data ends by itself
+		case MOS_RLE:
+			return mos_plane_decode(&attr_plane, MOS_RLE, stream, MOS_UNKNOWN_SIZE);
 
 		default:
 			for(i = 0; i < image->height; i++) {
@@ -262,54 +317,309 @@ FILL_WITH_BLANK:
 }
 
 
-int mos_fput(const MOSAIC *image, mos_attr_storage_fmt fmt, FILE *stream) {
-	fprintf(stream, "%dx%d\n", image->height, image->width);
+int mos_fget(MOSAIC *image, FILE *stream) {
+	mos_stream file = mos_file_stream(stream);
+	return mos_get(image, &file);
+}
 
-	// Mosaic //
-	int i;
-	for(i = 0; i < image->height; i++) {
-		fprintf(stream, "%.*s\n", image->width, image->mosaic[i]);
+
+int mos_mem_get(MOSAIC *image, const void *data, size_t size, size_t *consumed) {
+	mos_stream mem = mos_mem_stream(data, size);
+	const int ret = mos_get(image, &mem);
+	if(consumed) {
+		*consumed = mem.pos < size ? mem.pos : size;
+	}
+	return ret;
+}
+
+
+/**
+ * Write a row of the text part: its chars up to the first NUL, as if
+ * printed with "%.*s", then a newline.
+ */
+static void mos_put_text_row(mos_stream *stream, const mos_char *row, int width) {
+	if(width > 0) {
+		const mos_char *nul = memchr(row, '\0', width);
+		mos_stream_write(stream, row, nul ? nul - row : width);
 	}
+	mos_stream_putc(stream, '\n');
+}
 
+
+/**
+ * Write the binary part: SEPARATOR, the format identifier and the
+ * attributes in plane, encoded as fmt.
+ */
+static int mos_put_attrs(const mos_plane *plane, mos_attr_storage_fmt fmt, int level, mos_stream *stream) {
 	// time for binary stuff
-	fputc(SEPARATOR, stream);
+	mos_stream_putc(stream, SEPARATOR);
 
 	// put the format identifier
 	if(mos_is_valid_format(fmt)) {
-		fputc(fmt, stream);
+		mos_stream_putc(stream, fmt);
 	}
 	else {
-		fputc(MOS_NO_ATTR, stream);
+		mos_stream_putc(stream, MOS_NO_ATTR);
 		return MOS_EUNKNSTRGFMT;
 	}
 
-	// Attr //
+	size_t encoded_size;
 	switch (fmt) {
-		case MOS_UNCOMPRESSED:
-			for(i = 0; i < image->height; i++) {
-				fwrite(image->attr[i], sizeof(mos_attr), image->width, stream);
-			}
-			break;
-
-		// compress with zlib (if supported)
+		// compress with zlib, zstd or lz4 (if supported)
 		case MOS_COMPRESSED:
-			return compressMOSAIC(image, stream);
+		case MOS_ZSTD:
+		case MOS_LZ4:
+			return mos_plane_write_sized(plane, fmt, level, stream);
+
+		// raw and run-length encoded data end by themselves
+		case MOS_UNCOMPRESSED:
+		case MOS_RLE:
+			return mos_plane_encode(plane, fmt, level, stream, &encoded_size);
 
 		// no attributes, don't do anything =P
-		case MOS_NO_ATTR:
-			break;
+		default:
+			return MOS_OK;
+	}
+}
+
+
+/**
+ * Write image to stream as .mosi, see @ref mos_fput_level.
+ */
+static int mos_put(const MOSAIC *image, mos_attr_storage_fmt fmt, int level, mos_stream *stream) {
+	if(mos_is_tiled(image)) {
+		return MOS_EUNSUPPORTED;
+	}
+	char header[32];
+	mos_stream_write(stream, header, sprintf(header, "%dx%d\n", image->height, image->width));
+
+	// Mosaic //
+	int i;
+	for(i = 0; i < image->height; i++) {
+		mos_put_text_row(stream, image->width > 0 ? mos_char_row(image, i) : NULL, image->width);
+	}
+
+	// Attr //
+	const mos_plane attr_plane = { (MOSAIC *) image, 1, 0, image->height, NULL };
+	return mos_put_attrs(&attr_plane, fmt, level, stream);
+}
+
+
+int mos_fput(const MOSAIC *image, mos_attr_storage_fmt fmt, FILE *stream) {
+	return mos_fput_level(image, fmt, MOS_DEFAULT_LEVEL, stream);
+}
+
+
+int mos_fput_level(const MOSAIC *image, mos_attr_storage_fmt fmt, int level, FILE *stream) {
+	mos_stream file = mos_file_stream(stream);
+	return mos_put(image, fmt, level, &file);
+}
+
+
+int mos_mem_put(const MOSAIC *image, mos_attr_storage_fmt fmt, int level
+		, void *buffer, size_t capacity, size_t *size) {
+	mos_stream mem = { NULL, buffer, 0, capacity, 0, 0, MOS_OK };
+	int ret = mos_put(image, fmt, level, &mem);
+	*size = mem.length;
+	if(ret == MOS_OK && mem.length > capacity) {
+		ret = MOS_ETRUNCATED;
+	}
+	return ret;
+}
+
+
+int mos_mem_put_buffer(const MOSAIC *image, mos_attr_storage_fmt fmt, int level
+		, mos_mem_buffer *buffer) {
+	mos_stream mem = { NULL, (unsigned char *) buffer->data, 0, buffer->capacity, 0, 1, MOS_OK };
+	int ret = mos_put(image, fmt, level, &mem);
+	buffer->data = (char *) mem.data;
+	buffer->capacity = mem.capacity;
+	buffer->length = mem.length;
+	return ret == MOS_OK ? mem.error : ret;
+}
+
+
+void mos_mem_buffer_free(mos_mem_buffer *buffer) {
+	mos_dealloc(NULL, buffer->data);
+	buffer->data = NULL;
+	buffer->length = buffer->capacity = 0;
+}
+
+
+/// State of a row-streaming writer, see mos_writer_begin
+struct mos_writer {
+	mos_stream stream;	///< where the image is written to
+	mos_attr_storage_fmt fmt;	///< attributes' format
+	int level;	///< compression level
+	int height;	///< image height
+	int rows;	///< number of rows pushed so far
+	FILE *spool;	///< attributes pushed so far, NULL if they aren't stored
+	MOSAIC *row;	///< blank row for pushes with no chars or attributes, then where spooled attributes are read into
+};
+
+
+mos_writer *mos_writer_begin(FILE *stream, int height, int width
+		, mos_attr_storage_fmt fmt, int level, int *error) {
+	mos_writer *writer = NULL;
+	int ret = MOS_OK;
+	if(height < 0 || width < 0) {
+		ret = MOS_EUNSUPPORTED;
+	}
+	else if(!mos_is_valid_format(fmt)) {
+		ret = MOS_EUNKNSTRGFMT;
+	}
+	else if((writer = mos_malloc(NULL, sizeof(mos_writer))) == NULL) {
+		ret = MOS_EMALLOC;
+	}
+	else {
+		writer->stream = mos_file_stream(stream);
+		writer->fmt = fmt;
+		writer->level = level;
+		writer->height = height;
+		writer->rows = 0;
+		writer->spool = NULL;
+		if((writer->row = mos_new(1, width)) == NULL) {
+			ret = MOS_EMALLOC;
+		}
+		else {
+			// encoding no rows at all tells whether the format is supported
+			const mos_plane probe = { writer->row, 1, 0, 0, NULL };
+			size_t size;
+			ret = mos_plane_encode(&probe, fmt, level, NULL, &size);
+		}
+		// attributes come after all the text, so they wait in a spool
+		if(ret == MOS_OK && fmt != MOS_NO_ATTR && (writer->spool = tmpfile()) == NULL) {
+			ret = errno;
+		}
+		if(ret != MOS_OK) {
+			mos_free(writer->row);
+			mos_dealloc(NULL, writer);
+			writer = NULL;
+		}
+	}
+
+	if(writer) {
+		char header[32];
+		mos_stream_write(&writer->stream, header, sprintf(header, "%dx%d\n", height, width));
+	}
+	if(error) {
+		*error = ret;
+	}
+	return writer;
+}
+
+
+int mos_writer_push(mos_writer *writer, const mos_char *chars, const mos_attr *attrs) {
+	const int width = writer->row->width;
+	if(writer->rows == writer->height) {
+		return MOS_EUNSUPPORTED;
+	}
+	writer->rows++;
+	mos_put_text_row(&writer->stream, chars ? chars : writer->row->mosaic[0], width);
+	if(writer->spool
+			&& fwrite(attrs ? attrs : writer->row->attr[0], sizeof(mos_attr), width, writer->spool) != (size_t) width) {
+		return errno;
+	}
+	return MOS_OK;
+}
+
+
+int mos_writer_finish(mos_writer *writer) {
+	// rows never pushed are blank
+	int ret = MOS_OK;
+	while(ret == MOS_OK && writer->rows < writer->height) {
+		ret = mos_writer_push(writer, NULL, NULL);
+	}
+	// buffered spooling may only fail now, or have failed since a push
+	if(ret == MOS_OK && writer->spool) {
+		if(fflush(writer->spool) == EOF) {
+			ret = errno;
+		}
+		else if(ferror(writer->spool)) {
+			ret = EIO;
+		}
+	}
+	if(ret == MOS_OK) {
+		const mos_plane attr_plane = { writer->row, 1, 0, writer->height, writer->spool };
+		ret = mos_put_attrs(&attr_plane, writer->fmt, writer->level, &writer->stream);
+	}
+	if(writer->spool) {
+		fclose(writer->spool);
+	}
+	mos_free(writer->row);
+	mos_dealloc(NULL, writer);
+	return ret;
+}
+
+
+/// Magic string that starts deltas
+#define DELTA_MAGIC "MOSD"
+
+int mos_delta_fget(mos_delta *delta, FILE *stream) {
+	int height, width, count;
+	if(fscanf(stream, DELTA_MAGIC " %dx%d %d", &height, &width, &count) != 3
+			|| height < 0 || width < 0 || count < 0) {
+		return MOS_ENODIMENSIONS;
+	}
+	delta->height = height;
+	delta->width = width;
+	delta->count = 0;
+	delta->size = 0;
+
+	int i;
+	for(i = 0; i < count; i++) {
+		mos_run run;
+		int ret = fscanf(stream, "%d,%d,%d", &run.y, &run.x, &run.width);
+		if(ret == EOF) {
+			return MOS_ETRUNCATED;
+		}
+		if(ret != 3 || fgetc(stream) != '\n'
+				|| run.y < 0 || run.y >= height || run.x < 0 || run.width <= 0
+				|| run.width > width - run.x) {
+			return MOS_ECORRUPT;
+		}
+		// count may be bogus, so grow as runs are actually read
+		if(mos_delta_reserve(delta, i + 1, delta->size + run.width) != MOS_OK) {
+			return MOS_EMALLOC;
+		}
+		run.offset = delta->size;
+		if(fread(delta->mosaic + run.offset, sizeof(mos_char), run.width, stream) != (size_t) run.width
+				|| fread(delta->attr + run.offset, sizeof(mos_attr), run.width, stream) != (size_t) run.width) {
+			return MOS_ETRUNCATED;
+		}
+		delta->runs[delta->count++] = run;
+		delta->size += run.width;
 	}
+	return MOS_OK;
+}
 
+
+int mos_delta_fput(const mos_delta *delta, FILE *stream) {
+	fprintf(stream, DELTA_MAGIC " %dx%d %d\n", delta->height, delta->width, delta->count);
+	int i;
+	for(i = 0; i < delta->count; i++) {
+		const mos_run *run = delta->runs + i;
+		fprintf(stream, "%d,%d,%d\n", run->y, run->x, run->width);
+		fwrite(delta->mosaic + run->offset, sizeof(mos_char), run->width, stream);
+		fwrite(delta->attr + run->offset, sizeof(mos_attr), run->width, stream);
+	}
 	return MOS_OK;
 }
 
+#undef DELTA_MAGIC
+
 
 int mos_save(MOSAIC *image, mos_attr_storage_fmt fmt, const char *file_name) {
+	return mos_save_level(image, fmt, MOS_DEFAULT_LEVEL, file_name);
+}
+
+
+int mos_save_level(MOSAIC *image, mos_attr_storage_fmt fmt, int level, const char *file_name) {
 	FILE *f;
 	if((f = fopen(file_name, "w")) == NULL) {
 		return errno;
 	}
-	int ret = mos_fput(image, fmt, f);
+	int ret = mos_fput_level(image, fmt, level, f);
 	fclose(f);
 	return ret;
 }
@@ -325,5 +635,262 @@ int mos_load(MOSAIC *image, const char *file_name) {
 	return ret;
 }
 
+void mos_unmap(void *mapping, size_t size) {
+#ifdef ENABLE_MMAP
+	munmap(mapping, size);
+#endif
+}
+
+
+#ifdef ENABLE_MMAP
+/**
+ * Parse a nonnegative number from p, the way "%d" would in the common case.
+ *
+ * @return Where the number ends
+ * @return NULL if there's no plain number there
+ */
+static const char *mos_parse_dimension(const char *p, const char *end, int *n) {
+	const char *digits = p;
+	for(*n = 0; p < end && *p >= '0' && *p <= '9' && p - digits < 9; p++) {
+		*n = *n * 10 + (*p - '0');
+	}
+	return p > digits && (p == end || *p < '0' || *p > '9') ? p : NULL;
+}
+
+
+/**
+ * Set image up from a mapped .mosi file, with full width rows and
+ * uncompressed attributes pointing into the mapping.
+ *
+ * Only the usual layouts are handled, others are left for @ref mos_fget,
+ * so that the results are always the same.
+ *
+ * @return @ref MOS_OK on success
+ * @return @ref MOS_EMALLOC on allocation errors
+ * @return @ref MOS_EUNSUPPORTED if the file should be read instead
+ */
+static int mos_map_mosaic(MOSAIC *image, const char *p, const char *end) {
+	int height, width;
+	if((p = mos_parse_dimension(p, end, &height)) == NULL || p == end || *p++ != 'x'
+			|| (p = mos_parse_dimension(p, end, &width)) == NULL) {
+		return MOS_EUNSUPPORTED;
+	}
+	// nothing to map in empty images
+	else if(height == 0 || width == 0) {
+		return MOS_EUNSUPPORTED;
+	}
+	// rows are placed one by one, into the mapping or their own storage
+	if(mos_init_rows(image, height, width) != MOS_OK) {
+		return MOS_EMALLOC;
+	}
+	if(p < end && *p == '\n') {
+		p++;
+	}
+	// odd separators right after the header are left to mos_fget
+	else if(p < end && *p == SEPARATOR) {
+		return MOS_EUNSUPPORTED;
+	}
+
+	// full width rows point into the mapping right away, shorter ones
+	// are only counted until there's storage to copy them to
+	const char *text = p;
+	int i, short_rows = 0;
+	for(i = 0; i < height; i++) {
+		const int n = end - p < width ? end - p : width;
+		const char *newline = memchr(p, '\n', n);
+		const int length = newline ? newline - p : n;
+		// a row cut short by the separator: it and the others are blank
+		if(memchr(p, SEPARATOR, length)) {
+			break;
+		}
+		// cut short by EOF, leave it to mos_fget
+		if(newline == NULL && n < width) {
+			return MOS_EUNSUPPORTED;
+		}
+		if(newline) {
+			short_rows++;
+			p = newline + 1;
+		}
+		else {
+			mos_set_row(image, i, (mos_char *) p, NULL);
+			p += width;
+			if(p < end && *p == '\n') {
+				p++;
+			}
+			// the old separator right after the last full row quirk
+			else if(p == end || (*p == SEPARATOR && i == height - 1)) {
+				return MOS_EUNSUPPORTED;
+			}
+		}
+	}
+	const int text_rows = i;
+
+	const char *separator = memchr(p, SEPARATOR, end - p);
+	if(separator == NULL || separator + 1 == end) {
+		return MOS_EUNSUPPORTED;
+	}
+	const mos_attr_storage_fmt fmt = separator[1];
+	const char *attrs = separator + 2;
+	if(fmt == MOS_UNCOMPRESSED ? end - attrs < (ptrdiff_t) height * width : fmt != MOS_NO_ATTR) {
+		return MOS_EUNSUPPORTED;
+	}
+
+	// storage only for short and blank rows, and attributes not in the file
+	const size_t char_cells = (size_t) (short_rows + height - text_rows) * width;
+	const size_t attr_cells = fmt == MOS_NO_ATTR ? (size_t) height * width : 0;
+	mos_char *chars = mos_init_block(image, char_cells * sizeof(mos_char) + attr_cells * sizeof(mos_attr));
+	if(chars == NULL) {
+		return MOS_EMALLOC;
+	}
+	mos_attr *default_attrs = (mos_attr *) (chars + char_cells);
+
+	// go through the rows again, now copying the shorter ones
+	for(i = 0, p = text; i < height; i++) {
+		mos_char *row = image->mosaic[i];
+		if(row) {
+			p = row + width;
+			if(p < end && *p == '\n') {
+				p++;
+			}
+		}
+		else {
+			row = chars;
+			chars += width;
+			const char *newline = i < text_rows ? memchr(p, '\n', end - p < width ? end - p : width) : NULL;
+			const int length = newline ? newline - p : 0;
+			memcpy(row, p, length);
+			memset(row + length, MOS_DEFAULT_CHAR, width - length);
+			if(newline) {
+				p = newline + 1;
+			}
+		}
+
+		mos_attr *attr_row;
+		if(fmt == MOS_UNCOMPRESSED) {
+			attr_row = (mos_attr *) attrs + (size_t) i * width;
+		}
+		else {
+			attr_row = default_attrs + (size_t) i * width;
+			memset(attr_row, MOS_DEFAULT_ATTR, width * sizeof(mos_attr));
+		}
+		mos_set_row(image, i, row, attr_row);
+	}
+	return MOS_OK;
+}
+#endif
+
+
+MOSAIC *mos_load_mapped(const char *file_name, int *error) {
+	int ret = MOS_EUNSUPPORTED;
+	MOSAIC *image = mos_new(0, 0);
+	if(image == NULL) {
+		ret = MOS_EMALLOC;
+		goto END;
+	}
+
+#ifdef ENABLE_MMAP
+	int fd;
+	struct stat st;
+	if((fd = open(file_name, O_RDONLY)) < 0) {
+		ret = errno;
+		goto END;
+	}
+	void *mapping = MAP_FAILED;
+	if(fstat(fd, &st) == 0 && st.st_size > 0) {
+		// private and writable: writes to the image never reach the file
+		mapping = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if(mapping != MAP_FAILED) {
+		ret = mos_map_mosaic(image, mapping, (const char *) mapping + st.st_size);
+		if(ret != MOS_OK || !mos_attach_mapping(image, mapping, st.st_size)) {
+			munmap(mapping, st.st_size);
+		}
+		// the mapping may be referenced already, start over
+		if(ret != MOS_OK) {
+			mos_free(image);
+			if((image = mos_new(0, 0)) == NULL) {
+				ret = MOS_EMALLOC;
+				goto END;
+			}
+		}
+	}
+#endif
+
+	if(ret == MOS_EUNSUPPORTED) {
+		ret = mos_load(image, file_name);
+	}
+
+END:
+	if(error) {
+		*error = ret;
+	}
+	if(ret != MOS_OK && ret != MOS_EUNKNSTRGFMT) {
+		mos_free(image);
+		return NULL;
+	}
+	return image;
+}
+
+
+/**
+ * Boolean: is stream a .mosb one? Its position is rewound.
+ *
+ * .mosb files start with their magic, which is no .mosi header.
+ */
+static int mos_is_binary(FILE *stream) {
+	char magic[4];
+	const int binary = fread(magic, sizeof(char), 4, stream) == 4 && memcmp(magic, "MOSB", 4) == 0;
+	rewind(stream);
+	return binary;
+}
+
+
+int mos_load_region(MOSAIC *image, const char *file_name, int y, int x, int height, int width) {
+	if(mos_is_tiled(image)) {
+		return MOS_EUNSUPPORTED;
+	}
+	FILE *f;
+	if((f = fopen(file_name, "rb")) == NULL) {
+		return errno;
+	}
+	int ret;
+	if(mos_is_binary(f)) {
+		ret = mos_binary_fget_region(image, f, y, x, height, width);
+		fclose(f);
+		return ret;
+	}
+	fclose(f);
+
+	MOSAIC *full = mos_load_mapped(file_name, &ret);
+	if(full == NULL) {
+		return ret;
+	}
+	const int y0 = y > 0 ? y : 0, x0 = x > 0 ? x : 0;
+	const int y1 = y + height < full->height ? y + height : full->height;
+	const int x1 = x + width < full->width ? x + width : full->width;
+	int resized;
+	mos_lazy_free(image);
+	if((resized = mos_resize(image, y1 > y0 ? y1 - y0 : 0, x1 > x0 ? x1 - x0 : 0)) == MOS_OK) {
+		mos_blit(image, 0, 0, full, y0, x0, image->height, image->width, MOS_NO_KEY);
+	}
+	else {
+		ret = resized;
+	}
+	mos_free(full);
+	return ret;
+}
+
+
+int mos_load_lazy(MOSAIC *image, const char *file_name) {
+	FILE *f;
+	if((f = fopen(file_name, "rb")) == NULL) {
+		return errno;
+	}
+	const int binary = mos_is_binary(f);
+	fclose(f);
+	return binary ? mos_binary_load_lazy(image, file_name) : mos_load(image, file_name);
+}
+
 #undef SEPARATOR
 
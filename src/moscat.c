@@ -96,38 +96,15 @@ static struct argp argp = { options, parse_opt, args_doc, doc };
 
 /* MOSCAT */
 
-void reset_terminal_attr() {
-	printf("\e[0m");
-}
-void set_terminal_attr(mos_attr a) {
-	// terminal color codes
-	const char const *fg_color_table[] = {"30", "31", "32", "33", "34", "35", "36", "37"};
-	const char const *bg_color_table[] = {"40", "41", "42", "43", "44", "45", "46", "47"};
-
-	printf("\e[0m\e[%s;%s%s%sm"
-			, fg_color_table[mos_get_fg(a)]
-			, bg_color_table[mos_get_bg(a)]
-			, mos_get_bold(a) ? ";1" : ""
-			, mos_get_underline(a) ? ";4" : "");
-}
-
 /**
- * Prints the image at stdout, using `putchar`s
+ * Prints the image at stdout, rendered all at once
  *
  * @param[in] img The image to be displayed
  * @param[in] color Flag: display colors?
  */
 void printMOSAIC(MOSAIC *img, char color) {
-	int i, j;
-	for(i = 0; i < img->height; i++) {
-		for(j = 0; j < img->width; j++) {
-			if(color) {
-				set_terminal_attr(mos_get_attr(img, i, j));
-			}
-			putchar(mos_get_char(img, i, j));
-		}
-		reset_terminal_attr();
-		putchar('\n');
+	if(mos_render_ansi_fput(img, color, stdout) != MOS_OK) {
+		fprintf(stderr, "Couldn't render image: out of memory!\n");
 	}
 }
 
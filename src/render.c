@@ -0,0 +1,469 @@
+/*
+ * Copyright 2017 Gil Barbosa Reis <gilzoide@gmail.com>
+ * This file is part of libmosaic.
+ * 
+ * Libmosaic is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Libmosaic is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libmosaic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Any bugs should be reported to <gilzoide@gmail.com>
+ */
+
+#include "mosaic/render.h"
+#include "mosaic/diff.h"
+#include "internal.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/// An SGR escape sequence, with its length
+typedef struct {
+	const char *seq;
+	int length;
+} mos_sgr;
+
+/*
+ * SGR escapes for every attribute, resetting whatever was set before: fg
+ * in the lowest bits, then bg, bold and underline, just as in mos_attr.
+ */
+#define SGR_B0 ""
+#define SGR_B1 ";1"
+#define SGR_U0 ""
+#define SGR_U1 ";4"
+#define SGR_STR(fg, bg, b, u) "\033[0;3" #fg ";4" #bg SGR_B##b SGR_U##u "m"
+#define SGR(fg, bg, b, u) { SGR_STR(fg, bg, b, u), sizeof(SGR_STR(fg, bg, b, u)) - 1 }
+#define SGR_FG(bg, b, u) \
+	SGR(0, bg, b, u), SGR(1, bg, b, u), SGR(2, bg, b, u), SGR(3, bg, b, u), \
+	SGR(4, bg, b, u), SGR(5, bg, b, u), SGR(6, bg, b, u), SGR(7, bg, b, u)
+#define SGR_BG(b, u) \
+	SGR_FG(0, b, u), SGR_FG(1, b, u), SGR_FG(2, b, u), SGR_FG(3, b, u), \
+	SGR_FG(4, b, u), SGR_FG(5, b, u), SGR_FG(6, b, u), SGR_FG(7, b, u)
+
+static const mos_sgr sgr_table[256] = {
+	SGR_BG(0, 0), SGR_BG(1, 0), SGR_BG(0, 1), SGR_BG(1, 1),
+};
+
+#undef SGR_BG
+#undef SGR_FG
+#undef SGR
+#undef SGR_STR
+#undef SGR_U1
+#undef SGR_U0
+#undef SGR_B1
+#undef SGR_B0
+
+/// Length of the longest escape in sgr_table
+#define SGR_MAX (sizeof("\033[0;37;47;1;4m") - 1)
+/// Escape that resets attributes at the end of rows
+#define RESET "\033[0m"
+#define RESET_LENGTH (sizeof(RESET) - 1)
+
+static inline size_t max_size(size_t a, size_t b) {
+	return (a > b ? a : b);
+}
+
+/**
+ * Bytes a row of `width` cells may take, at most.
+ */
+static size_t mos_ansi_row_bound(int width, int color) {
+	return color ? (size_t) width * (SGR_MAX + 1) + RESET_LENGTH + 1 : (size_t) width + 1;
+}
+
+
+/**
+ * Exact number of bytes rendering row y of img takes.
+ */
+static size_t mos_ansi_row_length(MOSAIC *img, int y, int color) {
+	size_t length = img->width + 1;
+	if(color) {
+		int j, k, n, current = -1;
+		// rows may be split in tiles, so go span by span
+		for(j = 0; j < img->width; j += n) {
+			mos_char *chars;
+			mos_attr *attrs;
+			n = mos_span(img, y, j, 0, &chars, &attrs);
+			for(k = 0; k < n; k++) {
+				if(attrs[k] != current) {
+					current = attrs[k];
+					length += sgr_table[current].length;
+				}
+			}
+		}
+		length += RESET_LENGTH;
+	}
+	return length;
+}
+
+
+/**
+ * Render row y of img at out, which must have room for it.
+ *
+ * @return Where the row's rendering ends
+ */
+static char *mos_ansi_row(MOSAIC *img, int y, int color, char *out) {
+	int j, k, n, run, current = -1;
+	for(j = 0; j < img->width; j += n) {
+		mos_char *chars;
+		mos_attr *attrs;
+		n = mos_span(img, y, j, 0, &chars, &attrs);
+		if(!color) {
+			memcpy(out, chars, n * sizeof(mos_char));
+			out += n;
+			continue;
+		}
+		// escape only when the attribute changes, then copy the whole run
+		for(k = 0; k < n; k = run) {
+			if(attrs[k] != current) {
+				current = attrs[k];
+				memcpy(out, sgr_table[current].seq, sgr_table[current].length);
+				out += sgr_table[current].length;
+			}
+			for(run = k + 1; run < n && attrs[run] == current; run++);
+			memcpy(out, chars + k, (run - k) * sizeof(mos_char));
+			out += run - k;
+		}
+	}
+	if(color) {
+		memcpy(out, RESET, RESET_LENGTH);
+		out += RESET_LENGTH;
+	}
+	*out++ = '\n';
+	return out;
+}
+
+
+size_t mos_render_ansi(const MOSAIC *img, int color, char *buffer, size_t size) {
+	size_t used = 0;
+	int fits = 1;
+	int i;
+	for(i = 0; i < img->height; i++) {
+		// measuring is needed only when the worst case doesn't fit
+		if(fits && size - used >= mos_ansi_row_bound(img->width, color)) {
+			used = mos_ansi_row((MOSAIC *) img, i, color, buffer + used) - buffer;
+			continue;
+		}
+		const size_t length = mos_ansi_row_length((MOSAIC *) img, i, color);
+		if(fits && size - used >= length) {
+			mos_ansi_row((MOSAIC *) img, i, color, buffer + used);
+		}
+		else {
+			fits = 0;
+		}
+		used += length;
+	}
+	return used;
+}
+
+
+/**
+ * Make sure there's room for `size` more bytes in buffer.
+ *
+ * @return @ref MOS_OK on success
+ * @return @ref MOS_EMALLOC on allocation errors
+ */
+static int mos_render_reserve(mos_render_buffer *buffer, size_t size) {
+	if(buffer->capacity - buffer->length < size) {
+		const size_t capacity = max_size(buffer->length + size
+				, buffer->capacity + buffer->capacity / 2);
+		char *grown = mos_realloc(buffer->data, capacity);
+		if(grown == NULL) {
+			return MOS_EMALLOC;
+		}
+		buffer->data = grown;
+		buffer->capacity = capacity;
+	}
+	return MOS_OK;
+}
+
+
+int mos_render_ansi_buffer(const MOSAIC *img, int color, mos_render_buffer *buffer) {
+	const size_t bound = mos_ansi_row_bound(img->width, color);
+	buffer->length = 0;
+	int i;
+	for(i = 0; i < img->height; i++) {
+		if(mos_render_reserve(buffer, bound) != MOS_OK) {
+			return MOS_EMALLOC;
+		}
+		buffer->length = mos_ansi_row((MOSAIC *) img, i, color, buffer->data + buffer->length)
+				- buffer->data;
+	}
+	return MOS_OK;
+}
+
+
+int mos_render_ansi_fput(const MOSAIC *img, int color, FILE *stream) {
+	mos_render_buffer buffer = { NULL, 0, 0 };
+	int ret = mos_render_ansi_buffer(img, color, &buffer);
+	if(ret == MOS_OK) {
+		fwrite(buffer.data, 1, buffer.length, stream);
+	}
+	mos_render_buffer_free(&buffer);
+	return ret;
+}
+
+
+void mos_render_buffer_free(mos_render_buffer *buffer) {
+	mos_dealloc(NULL, buffer->data);
+	buffer->data = NULL;
+	buffer->length = buffer->capacity = 0;
+}
+
+struct mos_screen {
+	MOSAIC *shown;	///< what's displayed, NUL chars where unknown
+	mos_delta *delta;	///< changes from shown to the frame being rendered
+	mos_render_buffer buffer;	///< buffer for mos_screen_fput
+	int y;	///< cursor row, -1 if unknown
+	int x;	///< cursor column, -1 if unknown
+	int attr;	///< terminal's current attribute, -1 if unknown
+	size_t bytes;	///< bytes emitted for the last frame
+};
+
+/// Room for the longest cursor move, but for reprinted cells
+#define MOVE_MAX 32
+/// Escape that clears the terminal
+#define CLEAR "\033[0m\033[2J"
+
+mos_screen *mos_screen_new(void) {
+	mos_screen *screen = mos_malloc(NULL, sizeof(mos_screen));
+	if(screen == NULL) {
+		return NULL;
+	}
+	memset(screen, 0, sizeof(mos_screen));
+	if((screen->shown = mos_new(0, 0)) == NULL
+			|| (screen->delta = mos_delta_new()) == NULL) {
+		mos_screen_free(screen);
+		return NULL;
+	}
+	mos_screen_invalidate(screen);
+	return screen;
+}
+
+
+void mos_screen_free(mos_screen *screen) {
+	if(screen) {
+		mos_free(screen->shown);
+		mos_delta_free(screen->delta);
+		mos_render_buffer_free(&screen->buffer);
+		mos_dealloc(NULL, screen);
+	}
+}
+
+
+void mos_screen_invalidate(mos_screen *screen) {
+	// no char is ever NUL, so every cell is redrawn
+	mos_fill_char(screen->shown, '\0');
+	screen->y = screen->x = screen->attr = -1;
+}
+
+
+/// Number of decimal digits in n
+static int digits(int n) {
+	int d = 1;
+	for( ; n >= 10; n /= 10) {
+		d++;
+	}
+	return d;
+}
+
+/// Length of a CSI sequence with parameter n, omitted if it's 1
+static int csi_cost(int n) {
+	return n == 1 ? 3 : 3 + digits(n);
+}
+
+/// Cursor move strategies, see mos_cursor_move
+enum {
+	MOVE_NONE,	///< already there
+	MOVE_ABSOLUTE,	///< CUP to row and column
+	MOVE_REPRINT,	///< reprint the cells up to the column, same row
+	MOVE_RELATIVE,	///< CUU/CUD, then CUF/CUB
+	MOVE_RETURN,	///< CUU/CUD, carriage return, then CUF
+	MOVE_NEXT_LINE,	///< CNL, then CUF
+};
+
+/**
+ * Cost of moving the cursor from column `from` to `to`, in the same row,
+ * with CUF/CUB or backspaces.
+ */
+static int mos_horizontal_cost(int from, int to) {
+	if(to > from) {
+		return csi_cost(to - from);
+	}
+	if(to < from) {
+		// backspaces are a byte each
+		return from - to < csi_cost(from - to) ? from - to : csi_cost(from - to);
+	}
+	return 0;
+}
+
+/**
+ * Emit CUF/CUB or backspaces, whatever's cheaper, to move from column
+ * `from` to `to`, in the same row.
+ */
+static char *mos_horizontal_move(char *out, int from, int to) {
+	const int n = to > from ? to - from : from - to;
+	if(to > from) {
+		out += n == 1 ? sprintf(out, "\033[C") : sprintf(out, "\033[%dC", n);
+	}
+	else if(to < from) {
+		if(n < csi_cost(n)) {
+			memset(out, '\b', n);
+			out += n;
+		}
+		else {
+			out += n == 1 ? sprintf(out, "\033[D") : sprintf(out, "\033[%dD", n);
+		}
+	}
+	return out;
+}
+
+/**
+ * Emit the cheapest cursor move from where screen's cursor is to y/x.
+ */
+static char *mos_cursor_move(mos_screen *screen, char *out, int y, int x) {
+	const int cur_y = screen->y, cur_x = screen->x;
+	// CUP always works
+	int best = MOVE_ABSOLUTE;
+	int best_cost = 3 + digits(y + 1) + (x > 0 ? 1 + digits(x + 1) : 0);
+#define CONSIDER(move, cost) \
+	do { const int c = (cost); if(c < best_cost) { best = (move); best_cost = c; } } while(0)
+	if(cur_y >= 0) {
+		const int dy = y - cur_y;
+		const int vertical = dy ? csi_cost(dy > 0 ? dy : -dy) : 0;
+		if(cur_x >= 0) {
+			if(dy == 0 && cur_x == x) {
+				return out;
+			}
+			CONSIDER(MOVE_RELATIVE, vertical + mos_horizontal_cost(cur_x, x));
+			// reprinting is fine only if it doesn't need changing attributes
+			if(dy == 0 && x > cur_x && x - cur_x < best_cost) {
+				const mos_attr *attrs = screen->shown->attr[y];
+				int i;
+				for(i = cur_x; i < x && attrs[i] == screen->attr && screen->shown->mosaic[y][i]; i++);
+				if(i == x) {
+					CONSIDER(MOVE_REPRINT, x - cur_x);
+				}
+			}
+		}
+		CONSIDER(MOVE_RETURN, vertical + 1 + (x ? csi_cost(x) : 0));
+		if(dy > 0) {
+			CONSIDER(MOVE_NEXT_LINE, csi_cost(dy) + (x ? csi_cost(x) : 0));
+		}
+	}
+#undef CONSIDER
+
+	const int dy = y - cur_y;
+	switch(best) {
+		case MOVE_ABSOLUTE:
+			out += x > 0 ? sprintf(out, "\033[%d;%dH", y + 1, x + 1) : sprintf(out, "\033[%dH", y + 1);
+			break;
+		case MOVE_REPRINT:
+			memcpy(out, screen->shown->mosaic[y] + cur_x, x - cur_x);
+			out += x - cur_x;
+			break;
+		case MOVE_NEXT_LINE:
+			out += dy == 1 ? sprintf(out, "\033[E") : sprintf(out, "\033[%dE", dy);
+			out = mos_horizontal_move(out, 0, x);
+			break;
+		default:
+			if(dy) {
+				const int n = dy > 0 ? dy : -dy;
+				const char c = dy > 0 ? 'B' : 'A';
+				out += n == 1 ? sprintf(out, "\033[%c", c) : sprintf(out, "\033[%d%c", n, c);
+			}
+			if(best == MOVE_RETURN) {
+				*out++ = '\r';
+				out = mos_horizontal_move(out, 0, x);
+			}
+			else {
+				out = mos_horizontal_move(out, cur_x, x);
+			}
+			break;
+	}
+	return out;
+}
+
+
+int mos_screen_render(mos_screen *screen, const MOSAIC *frame, mos_render_buffer *buffer) {
+	buffer->length = 0;
+	screen->bytes = 0;
+	MOSAIC *shown = screen->shown;
+	// new dimensions, start over
+	if(shown->height != frame->height || shown->width != frame->width) {
+		if(mos_resize(shown, frame->height, frame->width) != MOS_OK
+				|| mos_render_reserve(buffer, sizeof(CLEAR)) != MOS_OK) {
+			mos_screen_invalidate(screen);
+			return MOS_EMALLOC;
+		}
+		mos_screen_invalidate(screen);
+		memcpy(buffer->data, CLEAR, sizeof(CLEAR) - 1);
+		buffer->length = sizeof(CLEAR) - 1;
+	}
+	if(mos_diff(screen->delta, shown, frame) != MOS_OK) {
+		mos_screen_invalidate(screen);
+		return MOS_EMALLOC;
+	}
+
+	const mos_delta *delta = screen->delta;
+	int i, k, run;
+	for(i = 0; i < delta->count; i++) {
+		const mos_run *r = delta->runs + i;
+		const mos_char *chars = delta->mosaic + r->offset;
+		const mos_attr *attrs = delta->attr + r->offset;
+		if(mos_render_reserve(buffer, MOVE_MAX + frame->width + r->width * (SGR_MAX + 1)) != MOS_OK) {
+			mos_screen_invalidate(screen);
+			return MOS_EMALLOC;
+		}
+		char *out = mos_cursor_move(screen, buffer->data + buffer->length, r->y, r->x);
+		// escape only when the attribute changes, then copy the whole run
+		for(k = 0; k < r->width; k = run) {
+			if(attrs[k] != screen->attr) {
+				screen->attr = attrs[k];
+				memcpy(out, sgr_table[screen->attr].seq, sgr_table[screen->attr].length);
+				out += sgr_table[screen->attr].length;
+			}
+			for(run = k + 1; run < r->width && attrs[run] == screen->attr; run++);
+			memcpy(out, chars + k, (run - k) * sizeof(mos_char));
+			out += run - k;
+		}
+		buffer->length = out - buffer->data;
+		screen->y = r->y;
+		// at the last column, the terminal may be about to wrap
+		screen->x = r->x + r->width < frame->width ? r->x + r->width : -1;
+	}
+
+	if(mos_patch(shown, delta) != MOS_OK) {
+		mos_screen_invalidate(screen);
+		return MOS_EMALLOC;
+	}
+	screen->bytes = buffer->length;
+	return MOS_OK;
+}
+
+
+int mos_screen_fput(mos_screen *screen, const MOSAIC *frame, FILE *stream) {
+	int ret = mos_screen_render(screen, frame, &screen->buffer);
+	if(ret == MOS_OK) {
+		fwrite(screen->buffer.data, 1, screen->buffer.length, stream);
+	}
+	return ret;
+}
+
+
+size_t mos_screen_bytes(const mos_screen *screen) {
+	return screen->bytes;
+}
+
+#undef CLEAR
+#undef MOVE_MAX
+#undef RESET_LENGTH
+#undef RESET
+#undef SGR_MAX
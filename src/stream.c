@@ -0,0 +1,73 @@
+/*
+ * Copyright 2017 Gil Barbosa Reis <gilzoide@gmail.com>
+ * This file is part of libmosaic.
+ * 
+ * Libmosaic is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Libmosaic is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libmosaic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Any bugs should be reported to <gilzoide@gmail.com>
+ */
+
+#include "mosaic/error.h"
+#include "internal.h"
+
+static inline size_t max_size(size_t a, size_t b) {
+	return (a > b ? a : b);
+}
+
+static inline size_t min_size(size_t a, size_t b) {
+	return (a < b ? a : b);
+}
+
+
+size_t mos_stream_write_grow(mos_stream *stream, const void *p, size_t n) {
+	const size_t end = stream->pos + n;
+	if(stream->growable && stream->error == MOS_OK) {
+		const size_t capacity = max_size(end, stream->capacity + stream->capacity / 2);
+		unsigned char *grown = mos_realloc(stream->data, capacity);
+		if(grown) {
+			stream->data = grown;
+			stream->capacity = capacity;
+		}
+		else {
+			stream->error = MOS_EMALLOC;
+		}
+	}
+	// whatever fits is written, the rest only counted
+	if(stream->pos < stream->capacity) {
+		memcpy(stream->data + stream->pos, p, min_size(n, stream->capacity - stream->pos));
+	}
+	stream->pos = end;
+	stream->length = max_size(stream->length, end);
+	return n;
+}
+
+
+long mos_stream_tell(mos_stream *stream) {
+	return stream->file ? ftell(stream->file) : (long) stream->pos;
+}
+
+
+int mos_stream_seek(mos_stream *stream, long offset, int whence) {
+	if(stream->file) {
+		return fseek(stream->file, offset, whence);
+	}
+	const long base = whence == SEEK_SET ? 0
+			: whence == SEEK_CUR ? (long) stream->pos
+			: (long) stream->length;
+	if(base + offset < 0) {
+		return -1;
+	}
+	stream->pos = base + offset;
+	return 0;
+}
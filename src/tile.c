@@ -0,0 +1,274 @@
+/*
+ * Copyright 2017 Gil Barbosa Reis <gilzoide@gmail.com>
+ * This file is part of libmosaic.
+ * 
+ * Libmosaic is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Libmosaic is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libmosaic.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Any bugs should be reported to <gilzoide@gmail.com>
+ */
+
+#include "mosaic/tile.h"
+#include "internal.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/// Tile dimension, for short
+#define TILE MOS_TILE_SIZE
+
+/// A square of cells in a tiled MOSAIC
+typedef struct {
+	mos_char mosaic[TILE * TILE];	///< the tile's chars, row after row
+	mos_attr attr[TILE * TILE];	///< the tile's attributes, row after row
+} mos_tile;
+
+struct mos_tiles {
+	int rows;	///< number of tile rows
+	int cols;	///< number of tile columns
+	int count;	///< number of allocated tiles
+	mos_tile **grid;	///< rows * cols tiles, NULL where blank
+};
+
+/// Initializers repeating v 64 times, and once for each cell of a tile
+#define REPEAT4(...) __VA_ARGS__, __VA_ARGS__, __VA_ARGS__, __VA_ARGS__
+#define REPEAT64(...) REPEAT4(REPEAT4(REPEAT4(__VA_ARGS__)))
+#define REPEAT_TILE(v) REPEAT64(REPEAT64(v))
+#if TILE != 64
+# error "blank_tile's initializer expects 64x64 tiles"
+#endif
+
+/// The tile shared by every untouched area, never written to
+static mos_tile blank_tile = {
+	{ REPEAT_TILE(MOS_DEFAULT_CHAR) },
+	{ REPEAT_TILE(MOS_DEFAULT_ATTR) },
+};
+
+#undef REPEAT_TILE
+#undef REPEAT64
+#undef REPEAT4
+
+static inline int min(int a, int b) {
+	return (a < b ? a : b);
+}
+
+/// Number of tiles needed to cover `n` cells
+static inline int tiles_for(int n) {
+	return n / TILE + (n % TILE != 0);
+}
+
+/// Number of tiles in the grid
+static inline size_t grid_size(const struct mos_tiles *tiles) {
+	return (size_t) tiles->rows * tiles->cols;
+}
+
+/// Grid slot of the tile covering cell (y, x)
+static inline mos_tile **grid_slot(const struct mos_tiles *tiles, int y, int x) {
+	return tiles->grid + (size_t) (y / TILE) * tiles->cols + x / TILE;
+}
+
+/**
+ * Blank the cells of a tile, from (y, x) on, in tile coordinates.
+ */
+static void blank_from(mos_tile *tile, int y, int x) {
+	int i;
+	if(x < TILE) {
+		for(i = 0; i < min(y, TILE); i++) {
+			memset(tile->mosaic + i * TILE + x, MOS_DEFAULT_CHAR, TILE - x);
+			memset(tile->attr + i * TILE + x, MOS_DEFAULT_ATTR, TILE - x);
+		}
+	}
+	for(i = y; i < TILE; i++) {
+		memset(tile->mosaic + i * TILE, MOS_DEFAULT_CHAR, TILE);
+		memset(tile->attr + i * TILE, MOS_DEFAULT_ATTR, TILE);
+	}
+}
+
+
+MOSAIC *mos_new_tiled(int height, int width) {
+	MOSAIC *img;
+	if((img = mos_malloc(NULL, sizeof(MOSAIC))) == NULL) {
+		return NULL;
+	}
+	memset(img, 0, sizeof(MOSAIC));
+	if((img->tiles = mos_malloc(NULL, sizeof(struct mos_tiles))) == NULL) {
+		mos_dealloc(NULL, img);
+		return NULL;
+	}
+	memset(img->tiles, 0, sizeof(struct mos_tiles));
+	if(mos_tiled_resize(img, height, width) != MOS_OK) {
+		mos_tiled_free(img);
+		mos_dealloc(NULL, img);
+		return NULL;
+	}
+	return img;
+}
+
+
+int mos_is_tiled(const MOSAIC *img) {
+	return (img->parent ? img->parent : img)->tiles != NULL;
+}
+
+
+int mos_tile_count(const MOSAIC *img) {
+	const struct mos_tiles *tiles = (img->parent ? img->parent : img)->tiles;
+	return tiles ? tiles->count : 0;
+}
+
+
+int mos_tiled_span(MOSAIC *img, int y, int x, int write, mos_char **chars, mos_attr **attrs) {
+	struct mos_tiles *tiles = img->tiles;
+	mos_tile **slot = grid_slot(tiles, y, x);
+	mos_tile *tile = *slot;
+	if(tile == NULL) {
+		if(!write) {
+			tile = &blank_tile;
+		}
+		else if((tile = mos_malloc(img->arena, sizeof(mos_tile))) == NULL) {
+			return 0;
+		}
+		else {
+			memcpy(tile, &blank_tile, sizeof(mos_tile));
+			*slot = tile;
+			tiles->count++;
+		}
+	}
+	const int offset = (y % TILE) * TILE + x % TILE;
+	*chars = tile->mosaic + offset;
+	*attrs = tile->attr + offset;
+	return min(TILE - x % TILE, img->width - x);
+}
+
+
+void mos_tiled_fill(MOSAIC *img, int y, int x, int height, int width, int plane, int value) {
+	const int default_value = plane ? MOS_DEFAULT_ATTR : MOS_DEFAULT_CHAR;
+	int i, j;
+	for(i = y; i < y + height; i = (i / TILE + 1) * TILE) {
+		const int tile_height = min(TILE - i % TILE, y + height - i);
+		for(j = x; j < x + width; j = (j / TILE + 1) * TILE) {
+			mos_tile *tile = *grid_slot(img->tiles, i, j);
+			// blank tiles are already filled with the default value
+			if(tile == NULL && value == default_value) {
+				continue;
+			}
+			const int tile_width = min(TILE - j % TILE, x + width - j);
+			int k;
+			for(k = 0; k < tile_height; k++) {
+				mos_char *chars;
+				mos_attr *attrs;
+				if(!mos_tiled_span(img, i + k, j, 1, &chars, &attrs)) {
+					return;
+				}
+				memset(plane ? (void *) attrs : (void *) chars, value, tile_width);
+			}
+		}
+	}
+}
+
+
+void mos_tiled_clear(MOSAIC *img) {
+	struct mos_tiles *tiles = img->tiles;
+	size_t i;
+	for(i = 0; i < grid_size(tiles); i++) {
+		mos_dealloc(img->arena, tiles->grid[i]);
+		tiles->grid[i] = NULL;
+	}
+	tiles->count = 0;
+}
+
+
+int mos_tiled_resize(MOSAIC *img, int new_height, int new_width) {
+	struct mos_tiles *tiles = img->tiles;
+	const int rows = tiles_for(new_height), cols = tiles_for(new_width);
+	const size_t size = (size_t) rows * cols;
+	mos_tile **grid = NULL;
+	if(size > 0) {
+		if(size > SIZE_MAX / sizeof(mos_tile *)
+				|| (grid = mos_malloc(img->arena, size * sizeof(mos_tile *))) == NULL) {
+			return MOS_EMALLOC;
+		}
+		memset(grid, 0, size * sizeof(mos_tile *));
+	}
+
+	int i, j;
+	for(i = 0; i < tiles->rows; i++) {
+		for(j = 0; j < tiles->cols; j++) {
+			mos_tile *tile = tiles->grid[(size_t) i * tiles->cols + j];
+			if(tile == NULL) {
+				continue;
+			}
+			// tiles out of bounds are gone, and the ones cut in half
+			// get blanks where they are out of bounds, so that they
+			// are blank if exposed again
+			if(i < rows && j < cols) {
+				grid[(size_t) i * cols + j] = tile;
+				blank_from(tile, new_height - i * TILE, new_width - j * TILE);
+			}
+			else {
+				mos_dealloc(img->arena, tile);
+				tiles->count--;
+			}
+		}
+	}
+
+	mos_dealloc(img->arena, tiles->grid);
+	tiles->grid = grid;
+	tiles->rows = rows;
+	tiles->cols = cols;
+	img->height = new_height;
+	img->width = new_width;
+	return MOS_OK;
+}
+
+
+void mos_tiled_shrink(MOSAIC *img) {
+	struct mos_tiles *tiles = img->tiles;
+	size_t i;
+	for(i = 0; i < grid_size(tiles); i++) {
+		if(tiles->grid[i] && memcmp(tiles->grid[i], &blank_tile, sizeof(mos_tile)) == 0) {
+			mos_dealloc(img->arena, tiles->grid[i]);
+			tiles->grid[i] = NULL;
+			tiles->count--;
+		}
+	}
+}
+
+
+MOSAIC *mos_tiled_clone(MOSAIC *src) {
+	MOSAIC *clone = mos_new_tiled(src->height, src->width);
+	if(clone == NULL) {
+		return NULL;
+	}
+	size_t i;
+	for(i = 0; i < grid_size(src->tiles); i++) {
+		if(src->tiles->grid[i]) {
+			if((clone->tiles->grid[i] = mos_malloc(NULL, sizeof(mos_tile))) == NULL) {
+				mos_tiled_free(clone);
+				mos_dealloc(NULL, clone);
+				return NULL;
+			}
+			memcpy(clone->tiles->grid[i], src->tiles->grid[i], sizeof(mos_tile));
+			clone->tiles->count++;
+		}
+	}
+	return clone;
+}
+
+
+void mos_tiled_free(MOSAIC *img) {
+	mos_tiled_clear(img);
+	mos_dealloc(img->arena, img->tiles->grid);
+	mos_dealloc(img->arena, img->tiles);
+}
+
+#undef TILE